@@ -1949,6 +1949,76 @@ static const unsigned char temp_976de91f[] =
 
 const char* README_md = (const char*) temp_976de91f;
 
+//================== SpeedTests.lua ==================
+static const unsigned char temp_5f8e2a41[] =
+"-- benchmark script to be run by the luabridge speed tests\r\n"
+"\r\n"
+"-- The loops run entirely inside Lua, so the numbers include the binding\r\n"
+"-- overhead of each operation but not the cost of entering Lua from C++.\r\n"
+"-- The report object is bound through LuaBridge and does the timing.\r\n"
+"\r\n"
+"local n, report = ...\r\n"
+"\r\n"
+"local function bench (name, loop)\r\n"
+"  loop (math.max (math.floor (n / 10), 1))\r\n"
+"  report:start ()\r\n"
+"  loop (n)\r\n"
+"  report:stop (name, n)\r\n"
+"end\r\n"
+"\r\n"
+"bench (\"free function\", function (n)\r\n"
+"  local f0 = f0\r\n"
+"  for i = 1, n do f0 () end\r\n"
+"end);\r\n"
+"\r\n"
+"bench (\"method call\", function (n)\r\n"
+"  local a = a\r\n"
+"  for i = 1, n do a:mf1 () end\r\n"
+"end);\r\n"
+"\r\n"
+"bench (\"method with args\", function (n)\r\n"
+"  local a = a\r\n"
+"  for i = 1, n do a:mf4 (i, i) end\r\n"
+"end);\r\n"
+"\r\n"
+"bench (\"property update\", function (n)\r\n"
+"  local a = a\r\n"
+"  for i = 1, n do a.prop = a.prop + 1 end\r\n"
+"end);\r\n"
+"\r\n"
+"bench (\"data sum\", function (n)\r\n"
+"  local a = a\r\n"
+"  local x = 0\r\n"
+"  for i = 1, n do x = x + a.data end\r\n"
+"end);\r\n"
+"\r\n"
+"bench (\"object creation\", function (n)\r\n"
+"  local A = A\r\n"
+"  for i = 1, n do local x = A () end\r\n"
+"end);\r\n"
+"\r\n"
+"bench (\"object table walk\", function (n)\r\n"
+"  local t = {}\r\n"
+"  for i = 1, 100 do t [i] = A () end\r\n"
+"  local j = 1\r\n"
+"  for i = 1, n do\r\n"
+"    t [j]:mf1 ()\r\n"
+"    j = j < 100 and j + 1 or 1\r\n"
+"  end\r\n"
+"end);\r\n"
+"\r\n"
+"bench (\"inherited call\", function (n)\r\n"
+"  local h = h5\r\n"
+"  for i = 1, n do h:hf () end\r\n"
+"end);\r\n"
+"\r\n"
+"bench (\"string argument\", function (n)\r\n"
+"  local f = strArg\r\n"
+"  for i = 1, n do f (\"Hello, world\") end\r\n"
+"end);\r\n";
+
+const char* SpeedTests_lua = (const char*) temp_5f8e2a41;
+
 //================== UnitTests.lua ==================
 static const unsigned char temp_e745c1cf[] =
 "-- test lua script to be run with the luabridge test program\r\n"
@@ -1993,6 +2063,7 @@ static const unsigned char temp_e745c1cf[] =
 "assert(testRetFloat() == 47.0);\r\n"
 "assert(testRetConstCharPtr() == \"Hello, world\");\r\n"
 "assert(testRetStdString() == \"Hello, world\");\r\n"
+"assert(testRetStdStringNul() == \"Hello\\0world\");\r\n"
 "\r\n"
 "testParamInt(47);                       assert(testSucceeded());\r\n"
 "testParamBool(true);                    assert(testSucceeded());\r\n"
@@ -2000,6 +2071,31 @@ static const unsigned char temp_e745c1cf[] =
 "testParamConstCharPtr(\"Hello, world\");  assert(testSucceeded());\r\n"
 "testParamStdString(\"Hello, world\");     assert(testSucceeded());\r\n"
 "testParamStdStringRef(\"Hello, world\");  assert(testSucceeded());\r\n"
+"testParamStdStringNul(\"Hello\\0world\");  assert(testSucceeded());\r\n"
+"testParamStringView(\"Hello\\0world\");    assert(testSucceeded());\r\n"
+"\r\n"
+"-- test integer conversions\r\n"
+"\r\n"
+"assert(testRetULongLong() == 2^60);\r\n"
+"testParamUnsignedChar(200);             assert(testSucceeded());\r\n"
+"testParamULongLong(2^60);               assert(testSucceeded());\r\n"
+"ok, err = pcall(testParamUnsignedChar, 256);   assert(not ok and string.find(err, \"out of range\"));\r\n"
+"ok, err = pcall(testParamULongLong, -1);       assert(not ok and string.find(err, \"out of range\"));\r\n"
+"ok, err = pcall(testParamInt, 2^40);           assert(not ok and string.find(err, \"out of range\"));\r\n"
+"assert(testEchoInt(2^31 - 1) == 2^31 - 1 and testEchoInt(-2^31) == -2^31);\r\n"
+"assert(testEchoInt(2.75) == 2 and testEchoInt(-2.75) == -2);\r\n"
+"ok, err = pcall(testEchoInt, 2^31);            assert(not ok and string.find(err, \"out of range\"));\r\n"
+"ok, err = pcall(testEchoInt, -2^31 - 1);       assert(not ok and string.find(err, \"out of range\"));\r\n"
+"ok, err = pcall(testEchoInt, 0/0);             assert(not ok and string.find(err, \"out of range\"));\r\n"
+"assert(testEchoInt(2^31 - 0.5) == 2^31 - 1 and testEchoInt(-2^31 - 0.5) == -2^31);\r\n"
+"assert(testEchoUnsignedChar(-0.5) == 0 and testEchoUnsignedChar(255.5) == 255);\r\n"
+"ok, err = pcall(testEchoUnsignedChar, -1);     assert(not ok and string.find(err, \"out of range\"));\r\n"
+"assert(testEchoLongLong(-2^63) == -2^63);\r\n"
+"ok, err = pcall(testEchoLongLong, 2^63);       assert(not ok and string.find(err, \"out of range\"));\r\n"
+"\r\n"
+"-- test unchecked functions\r\n"
+"\r\n"
+"testParamIntUnchecked(47);              assert(testSucceeded());\r\n"
 "\r\n"
 "-- test static methods of classes registered from C++\r\n"
 "\r\n"
@@ -2043,6 +2139,17 @@ static const unsigned char temp_e745c1cf[] =
 "testParamConstAPtr(constA);        assert(constA:testSucceeded());\r\n"
 "assert(pcall(testParamAPtr, constA) == false, \"attempt to call nil value\");\r\n"
 "\r\n"
+"-- test unchecked member functions\r\n"
+"\r\n"
+"assert(object1:getNameUnchecked() == \"object1\");\r\n"
+"assert(object2:getNameUnchecked() == \"object2\");\r\n"
+"testParamAPtrUnchecked(object1);  assert(object1:testSucceeded());\r\n"
+"\r\n"
+"-- test type checking\r\n"
+"\r\n"
+"ok, err = pcall(testParamAPtr, 47);   assert(not ok and string.find(err, \"A expected, got number\"));\r\n"
+"ok, err = pcall(testParamAPtr, {});   assert(not ok and string.find(err, \"A expected, got table\"));\r\n"
+"\r\n"
 "-- test properties\r\n"
 "\r\n"
 "assert(object1.testProp == 47);\r\n"
@@ -2057,6 +2164,84 @@ static const unsigned char temp_e745c1cf[] =
 "object1a = object1 + object1;      assert(testAFnCalled(FN_OPERATOR));\r\n"
 "assert(object1a:getName() == \"object1 + object1\");\r\n"
 "\r\n"
+"-- test flattened derived classes\r\n"
+"\r\n"
+"object3 = C(\"object3\");         assert(testAFnCalled(FN_CTOR));\r\n"
+"object3:testVirtual();          assert(testAFnCalled(FN_VIRTUAL));\r\n"
+"assert(object3:getName() == \"object3\");\r\n"
+"assert(object3.testProp == 47);\r\n"
+"assert(object3.testProp2 == 47);    assert(testAFnCalled(FN_PROPGET));\r\n"
+"object3.testProp2 = 48;         assert(testAFnCalled(FN_PROPSET) and object3.testProp == 48);\r\n"
+"testParamAPtr(object3);         assert(object3:testSucceeded());\r\n"
+"assert(object3:getNameAfterDerive() == \"object3\");\r\n"
+"\r\n"
+"-- test that a flattened class does not inherit its base's finalizer\r\n"
+"\r\n"
+"object10 = H(53);\r\n"
+"testDeriveFlattenedI();\r\n"
+"object10 = I(54);               assert(object10:getValue() == 54);\r\n"
+"object10 = nil; collectgarbage();\r\n"
+"\r\n"
+"-- test classes with member functions only\r\n"
+"\r\n"
+"object4 = D(47);\r\n"
+"assert(object4:getValue() == 47);\r\n"
+"object4:setValue(48);           assert(object4:getValue() == 48);\r\n"
+"assert(object4.noSuchMember == nil);\r\n"
+"assert(object4.__index == nil and object4.__newindex == nil);\r\n"
+"\r\n"
+"-- test the identity cache\r\n"
+"\r\n"
+"assert(testRetAPtr() ~= testRetAPtr());\r\n"
+"testSetIdentityCache(true);\r\n"
+"assert(testRetAPtr() == testRetAPtr());\r\n"
+"assert(testRetSharedPtrA() == testRetSharedPtrA());\r\n"
+"assert(testRetAPtr():getName() == \"from C\");\r\n"
+"collectgarbage();\r\n"
+"assert(testRetAPtr() == testRetAPtr());\r\n"
+"testSetIdentityCache(false);\r\n"
+"\r\n"
+"-- test finalizers\r\n"
+"\r\n"
+"object5 = testRetA();           testAFnCalled(FN_DTOR);\r\n"
+"assert(object5:getName() == \"by value\");\r\n"
+"object5 = nil; collectgarbage(); assert(testAFnCalled(FN_DTOR));\r\n"
+"object5 = B(\"object5\");\r\n"
+"object5 = nil; collectgarbage(); assert(testBFnCalled(FN_DTOR));\r\n"
+"object6 = testRetSharedPtrD();  assert(testSharedPtrDUseCount() == 2);\r\n"
+"object6 = nil; collectgarbage(); assert(testSharedPtrDUseCount() == 1);\r\n"
+"\r\n"
+"-- test intrusive reference counts\r\n"
+"\r\n"
+"object7 = testRetSharedPtrE();  assert(testSharedPtrEUseCount() == 2);\r\n"
+"assert(object7:getValue() == 48);\r\n"
+"object7 = nil; collectgarbage(); assert(testSharedPtrEUseCount() == 1);\r\n"
+"object7 = E(49);\r\n"
+"assert(object7:getValue() == 49);\r\n"
+"testParamSharedPtrE(object7);   assert(testKeptEUseCount() == 2);\r\n"
+"object7 = nil; collectgarbage(); assert(testKeptEUseCount() == 1);\r\n"
+"\r\n"
+"-- test that released objects leave the reference count table\r\n"
+"\r\n"
+"collectgarbage();\r\n"
+"local tableSize = testRefCountTableSize();\r\n"
+"object8 = A(\"counted\");           assert(testRefCountTableSize() == tableSize + 1);\r\n"
+"object8 = nil; collectgarbage();  assert(testRefCountTableSize() == tableSize);\r\n"
+"\r\n"
+"-- test std::shared_ptr, when the compiler has it\r\n"
+"\r\n"
+"if testRetStdSharedPtrG then\r\n"
+"  object9 = testRetStdSharedPtrG();   assert(testStdSharedPtrGUseCount() == 2);\r\n"
+"  assert(object9:getValue() == 50);\r\n"
+"  testParamStdSharedPtrF(object9);    assert(testStdSharedPtrGUseCount() == 3);\r\n"
+"  object9 = nil; collectgarbage();    assert(testStdSharedPtrGUseCount() == 2);\r\n"
+"  testParamStdSharedPtrF(nil);        assert(testStdSharedPtrGUseCount() == 1);\r\n"
+"  object9 = G(51);\r\n"
+"  testParamStdSharedPtrF(object9);    assert(testKeptFUseCount() == 2);\r\n"
+"  object9 = nil; collectgarbage();    assert(testKeptFUseCount() == 1);\r\n"
+"  assert(not pcall(testParamStdSharedPtrF, D(52)));\r\n"
+"end\r\n"
+"\r\n"
 "print(\"All tests succeeded.\");\r\n";
 
 const char* UnitTests_lua = (const char*) temp_e745c1cf;
@@ -2075,7 +2260,8 @@ const char* getNamedResource (const char* resourceNameUTF8, int& numBytes) throw
         case 0x56d6eea3:  numBytes = 678; return CHANGES;
         case 0x5b423868:  numBytes = 78384; return Doxyfile;
         case 0x64791dc8:  numBytes = 32694; return README_md;
-        case 0x75161396:  numBytes = 3877; return UnitTests_lua;
+        case 0xfa677473:  numBytes = 1454; return SpeedTests_lua;
+        case 0x75161396:  numBytes = 9104; return UnitTests_lua;
         default: break;
     }
 
@@ -15,8 +15,11 @@ namespace BinaryData
     extern const char*   README_md;
     const int            README_mdSize = 32694;
 
+    extern const char*   SpeedTests_lua;
+    const int            SpeedTests_luaSize = 1454;
+
     extern const char*   UnitTests_lua;
-    const int            UnitTests_luaSize = 3877;
+    const int            UnitTests_luaSize = 9104;
 
     // If you provide the name of one of the binary resource variables above, this function will
     // return the corresponding data and its size (or a null pointer if the name isn't found).
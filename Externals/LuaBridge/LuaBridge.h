@@ -363,6 +363,17 @@
   that is **not** registered with Lua, there is no need to declare it as a
   subclass.
 
+  Inherited members are found by searching the chain of base classes when they
+  are used. For deep hierarchies, passing `true` as the second argument to
+  `deriveClass` flattens the class instead: the member functions, data members
+  and properties of the base class are copied into the derived class when it is
+  registered. Members added to the base class later are copied as well, unless
+  the derived class overrides them. Metamethods such as `__add` are not copied.
+
+  A class without data members or properties, which has no base class or is
+  flattened from such a class, has its member functions looked up directly by
+  the Lua virtual machine, without a call into LuaBridge.
+
   ### Property Member Proxies
 
   Sometimes when registering a class which comes from a third party library, the
@@ -467,8 +478,13 @@
 
   - `bool`
   - `char`, converted to a string of length one.
-  - `char const*` and `std::string` strings.
-  - Integers, `float`, and `double`, converted to `Lua_number`.
+  - `char const*` and `std::string` strings. A `std::string` keeps embedded zeroes.
+  - `StringView`, a string parameter which refers to the characters of the Lua
+    string without copying them. It is valid only until the function returns.
+  - Integers up to `long long`, `float`, and `double`. An integer argument outside
+    the range of its type is an error, and a fraction is truncated toward zero.
+    Defining `LUABRIDGE_TRUSTED_INTEGERS` to 1 skips the checks on integer
+    arguments, for scripts which are trusted.
 
   User-defined types which are convertible to one of the basic types are
   possible, simply provide a `Stack <>` specialization in the `luabridge`
@@ -674,10 +690,17 @@
         a->foo ();
       }
 
+  `RefCountedObject` counts references with a plain integer, so references to
+  one object must not be taken or released on two threads at once. For objects
+  shared between threads, for example between `lua_State` objects on different
+  threads, derive from `AtomicRefCountedObject` instead.
+
   ### The `RefCountedPtr` Container
 
   This is a non intrusive reference counted pointer. The reference counts are
   kept in a global hash table, which does incur a small performance penalty.
+  An entry is removed when its count drops to zero, and
+  `RefCountedPtrBase::getRefCountTableSize` returns the number of entries.
   However, it does not require changing any already existing class declarations.
   This is especially useful when the classes to be registered come from a third
   party library and cannot be modified. To use it, simply wrap all pointers
@@ -711,6 +734,15 @@
         // when we leave this scope
       }
 
+  If the class derives from `RefCountedObjectType`, `RefCountedPtr` uses the
+  reference count in the object instead of the hash table. Copying such a
+  pointer is then a single increment, and the two pointer types may be mixed
+  freely on the same object.
+
+  When the compiler supports rvalue references, both pointer types can be
+  moved. A container returned by value from a bound function is then moved
+  into Lua without changing the reference count.
+
   ### Custom Containers
 
   If you have your own container, you must provide a specialization of
@@ -728,12 +760,19 @@
         }
       };
 
-  Standard containers like `std::shared_ptr` or `boost::shared_ptr` **will not
-  work**. This is because of type erasure; when the object goes from C++ to
-  Lua and back to C++, there is no way to associate the object with the
-  original container. The new container is constructed from a pointer to the
-  object instead of an existing container. The result is undefined behavior
-  since there are now two sets of reference counts.
+  Other shared pointers like `boost::shared_ptr` **will not work**. This
+  is because of type erasure; when the object goes from C++ to Lua and back to
+  C++, there is no way to associate the object with the original container.
+  The new container is constructed from a pointer to the object instead of an
+  existing container. The result is undefined behavior since there are now
+  two sets of reference counts.
+
+  `std::shared_ptr` is supported when the compiler provides it, which
+  `LUABRIDGE_HAS_STD_SHARED_PTR` tells. The userdata keeps a copy of the
+  `std::shared_ptr`, so there is only one reference count. An object pushed as
+  a derived class may be passed back as a `std::shared_ptr` to a base class.
+  Passing an object which is not held by a `std::shared_ptr`, such as one
+  created with a plain constructor, is a Lua error.
 
   ### Container Construction
 
@@ -776,6 +815,13 @@
   object). An object store in a container can be passed to a function expecting
   a pointer. These conversion work seamlessly.
 
+  Each push of a pointer or container normally creates a new userdata, so two
+  references to the same object are not equal in Lua. Calling
+  `setIdentityCache (L, true)` makes the `lua_State*` remember the userdata
+  pushed for each object, and push it again while it is still alive. This saves
+  an allocation per push, and `==` compares the objects. Pointers and containers
+  get separate userdata, as do const and non-const references.
+
   ## Security
 
   The metatables and userdata that LuaBridge creates in the `lua_State*` are
@@ -815,6 +861,24 @@
   the use of `lua_pcall`; proper usage of LuaBridge will never result in
   undefined behavior.
 
+  For functions which are only called by trusted scripts, the checks can be
+  skipped by passing `Unchecked ()` as the last argument of `addFunction`:
+
+      getGlobalNamespace (L)
+        .beginClass <A> ("A")
+          .addFunction ("getValue", &A::getValue, Unchecked ())
+        .endClass ();
+
+  The object is then taken from the first argument without checking its class
+  or const-ness, and arguments of basic types are converted without errors.
+  Calling an unchecked function with the wrong arguments is undefined behavior.
+
+  The saving is a fixed cost per call, and how large it is next to the rest of
+  the call depends on the compiler, the build settings and the machine. It has
+  been measured at anywhere from about 5% to about 35% of a two argument member
+  call. Compare the `checked 2 args` and `unchecked 2 args` results of the speed
+  tests on the target build before relying on it.
+
   ## Limitations 
 
   LuaBridge does not support:
@@ -869,7 +933,26 @@
 */
 
 #include <cassert>
+#include <cmath>
+#include <limits>
 #include <string>
+#include <utility>
+
+/**
+  LUABRIDGE_HAS_STD_SHARED_PTR tells if std::shared_ptr is available, in
+  which case it may be used as a container for class objects.
+*/
+#ifndef LUABRIDGE_HAS_STD_SHARED_PTR
+#if __cplusplus >= 201103L || (defined (_MSC_VER) && (_MSC_VER >= 1600))
+#define LUABRIDGE_HAS_STD_SHARED_PTR 1
+#else
+#define LUABRIDGE_HAS_STD_SHARED_PTR 0
+#endif
+#endif
+
+#if LUABRIDGE_HAS_STD_SHARED_PTR
+#include <memory>
+#endif
 
 namespace luabridge
 {
@@ -888,6 +971,40 @@ namespace luabridge
 #define LUABRIDGE_THROWSPEC throw()
 #endif
 
+/**
+  LUABRIDGE_HAS_TRIVIAL_DESTRUCTOR (T) tells if the destructor of T does
+  nothing, using the type trait intrinsic of the compiler. Compilers without
+  the intrinsic treat every destructor as non-trivial, which is always safe.
+*/
+#if defined (__clang__) && defined (__has_builtin)
+#if __has_builtin (__is_trivially_destructible)
+#define LUABRIDGE_HAS_TRIVIAL_DESTRUCTOR(T) __is_trivially_destructible (T)
+#endif
+#endif
+#ifndef LUABRIDGE_HAS_TRIVIAL_DESTRUCTOR
+#if defined (__clang__) || \
+    (defined (__GNUC__) && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 3))) || \
+    (defined (_MSC_VER) && (_MSC_VER >= 1400))
+#define LUABRIDGE_HAS_TRIVIAL_DESTRUCTOR(T) __has_trivial_destructor (T)
+#else
+#define LUABRIDGE_HAS_TRIVIAL_DESTRUCTOR(T) false
+#endif
+#endif
+
+/**
+  LUABRIDGE_COMPILER_SUPPORTS_MOVE_SEMANTICS tells if rvalue references may
+  be used. When they can, a container returned by value from a bound function
+  is moved into its userdata without touching the reference count. Define it
+  to 0 or 1 before including LuaBridge.h to override the detection.
+*/
+#ifndef LUABRIDGE_COMPILER_SUPPORTS_MOVE_SEMANTICS
+#if __cplusplus >= 201103L || (defined (_MSC_VER) && (_MSC_VER >= 1600))
+#define LUABRIDGE_COMPILER_SUPPORTS_MOVE_SEMANTICS 1
+#else
+#define LUABRIDGE_COMPILER_SUPPORTS_MOVE_SEMANTICS 0
+#endif
+#endif
+
 //==============================================================================
 /**
   Templates for extracting type information.
@@ -2111,6 +2228,26 @@ struct ContainerTraits
   typedef bool isNotContainer;
 };
 
+#if LUABRIDGE_HAS_STD_SHARED_PTR
+/**
+  Container traits for std::shared_ptr.
+
+  The userdata holds a std::shared_ptr which shares ownership with the one
+  that was pushed, so no second reference count is involved. An object
+  pushed as a derived class may be retrieved as a std::shared_ptr to a base.
+*/
+template <class T>
+struct ContainerTraits <std::shared_ptr <T> >
+{
+  typedef T Type;
+
+  static T* get (std::shared_ptr <T> const& c)
+  {
+    return c.get ();
+  }
+};
+#endif
+
 //==============================================================================
 
 #if LUA_VERSION_NUM < 502
@@ -2141,6 +2278,11 @@ inline void lua_rawsetp (lua_State *L, int idx, void const* p)
   lua_insert (L, -2);
   lua_rawset (L, idx);
 }
+
+inline size_t lua_rawlen (lua_State *L, int idx)
+{
+  return lua_objlen (L, idx);
+}
 #endif
 
 //------------------------------------------------------------------------------
@@ -2264,6 +2406,16 @@ namespace Detail
     {
       typedef T Type;
     };
+
+    //--------------------------------------------------------------------------
+    /**
+      Determine if destroying a T does nothing.
+    */
+    template <class T>
+    struct isTriviallyDestructible
+    {
+      static bool const value = LUABRIDGE_HAS_TRIVIAL_DESTRUCTOR (T);
+    };
   };
 
   //============================================================================
@@ -2272,8 +2424,8 @@ namespace Detail
 
     LuaBridge metatables are tagged with a security "token." The token is a
     lightuserdata created from the identity pointer, used as a key in the
-    metatable. The value is a boolean = true, although any value could have been
-    used.
+    metatable. The value is the compiled Ancestry of the class (see below),
+    although any value could have been used.
 
     Because of Lua's dynamic typing and our improvised system of imposing C++
     class structure, there is the possibility that executing scripts may
@@ -2314,7 +2466,65 @@ namespace Detail
     has a metatable, and the metatable has a value for a lightuserdata key
     with this identity pointer address, that LuaBridge created the userdata.
   */
-  static inline void* getIdentityKey ()
+  inline void* getIdentityKey ()
+  {
+    static char value;
+    return &value;
+  }
+
+  //----------------------------------------------------------------------------
+  /**
+    Keys for the metafields of LuaBridge tables.
+
+    Lua looks up its own metamethods such as __index and __gc by name, but the
+    fields that only LuaBridge reads are stored under these lightuserdata keys.
+    A lightuserdata key is found with lua_rawgetp without pushing a string,
+    which would otherwise go through the string interner on every call of a
+    metamethod. The comments refer to these fields by their former names.
+  */
+  inline void const* getPropgetKey ()
+  {
+    static char value;
+    return &value;
+  }
+
+  inline void const* getPropsetKey ()
+  {
+    static char value;
+    return &value;
+  }
+
+  inline void const* getParentKey ()
+  {
+    static char value;
+    return &value;
+  }
+
+  inline void const* getConstTableKey ()
+  {
+    static char value;
+    return &value;
+  }
+
+  inline void const* getClassTableKey ()
+  {
+    static char value;
+    return &value;
+  }
+
+  inline void const* getTypeKey ()
+  {
+    static char value;
+    return &value;
+  }
+
+  inline void const* getDerivedKey ()
+  {
+    static char value;
+    return &value;
+  }
+
+  inline void const* getMethodsKey ()
   {
     static char value;
     return &value;
@@ -2372,252 +2582,427 @@ namespace Detail
 
   //============================================================================
   /**
-    Interface to a class poiner retrievable from a userdata.
+    Compiled ancestry of a class.
+
+    Each class table and const table stores one of these, in a userdata, as the
+    value for the identity key. It holds the class key of the class followed by
+    the class keys of its base classes, most derived first. This turns the
+    question "is this object a T or derived from T" into a short scan of
+    pointers instead of a walk up the __parent chain of metatables.
+
+    A table is flat if it holds all of its inherited members, which is the
+    case for a class without a base, or a class flattened from a flat base.
+    The table has a finalizer once a __gc metamethod was installed in it.
   */
-  class Userdata
+  struct Ancestry
   {
-  protected:
-    void* m_p; // subclasses must set this
+    int count;
+    bool isConst;
+    bool isFlat;
+    bool hasFinalizer;
+    void const* keys [1]; // actually [count]
 
     //--------------------------------------------------------------------------
     /**
-      Get an untyped pointer to the contained class.
+      Push a new Ancestry onto the Lua stack.
+
+      The keys of the base class, if any, are appended to the class key.
     */
-    inline void* const getPointer ()
+    static Ancestry* push (lua_State* L, void const* classKey,
+                           bool isConst, bool isFlat, Ancestry const* base)
     {
-      return m_p;
+      int const count = 1 + (base != 0 ? base->count : 0);
+      Ancestry* const a = static_cast <Ancestry*> (lua_newuserdata (L,
+        sizeof (Ancestry) + (count - 1) * sizeof (void const*)));
+      a->count = count;
+      a->isConst = isConst;
+      a->isFlat = isFlat;
+      a->hasFinalizer = false;
+      a->keys [0] = classKey;
+      for (int i = 1; i < count; ++i)
+        a->keys [i] = base->keys [i - 1];
+      return a;
     }
 
-  private:
     //--------------------------------------------------------------------------
     /**
-      Validate and retrieve a Userdata on the stack.
+      Retrieve the Ancestry of a class table or const table.
 
-      The Userdata must exactly match the corresponding class table or
-      const table, or else a Lua error is raised. This is used for the
-      __gc metamethod.
+      Returns null if the table was not created by LuaBridge.
     */
-    static Userdata* getExactClass (lua_State* L, int narg, void const* const classKey)
+    static Ancestry* get (lua_State* L, int index)
     {
-      Userdata* ud = 0;
-      int const index = lua_absindex (L, narg);
+      lua_rawgetp (L, index, getIdentityKey ());
+      Ancestry* const a = static_cast <Ancestry*> (lua_touserdata (L, -1));
+      lua_pop (L, 1);
+      return a;
+    }
 
-      bool mismatch = false;
-      char const* got = 0;
+    //--------------------------------------------------------------------------
+    /**
+      Determine if the class key identifies this class or one of its bases.
+    */
+    bool isDerivedFrom (void const* const classKey) const
+    {
+      for (int i = 0; i < count; ++i)
+      {
+        if (keys [i] == classKey)
+          return true;
+      }
+      return false;
+    }
+  };
 
-      lua_rawgetp (L, LUA_REGISTRYINDEX, classKey);
-      assert (lua_istable (L, -1));
+  //============================================================================
+  /**
+    Optional per-state cache of the userdata which refer to class objects.
 
-      // Make sure we have a userdata.
-      if (!mismatch && !lua_isuserdata (L, index))
-        mismatch = true;
+    When the cache is enabled, pushing the same pointer again with the same
+    metatable returns the existing userdata instead of allocating a new one.
+    This saves an allocation and a garbage collected object for each push,
+    and makes the == operator in Lua true for two references to an object.
 
-      // Make sure it's metatable is ours.
-      if (!mismatch)
-      {
-        lua_getmetatable (L, index);
-        lua_rawgetp (L, -1, getIdentityKey ());
-        if (lua_isboolean (L, -1))
-        {
-          lua_pop (L, 1);
-        }
-        else
-        {
-          lua_pop (L, 2);
-          mismatch = true;
-        }      
-      }
+    The userdata are held in weak-valued tables, so the cache does not extend
+    their lifetime. Userdata which only refer to an object and userdata which
+    hold a container are kept apart, because they differ in ownership.
+  */
+  class IdentityCache
+  {
+  public:
+    /** The kinds of userdata which are cached.
+    */
+    enum Kind
+    {
+      pointer,
+      container
+    };
 
-      if (!mismatch)
+    //--------------------------------------------------------------------------
+    /**
+      Enable or disable the cache for a lua_State.
+    */
+    static void setEnabled (lua_State* L, bool enable)
+    {
+      if (enable)
       {
-        if (lua_rawequal (L, -1, -2))
-        {
-          // Matches class table.
-          lua_pop (L, 2);
-          ud = static_cast <Userdata*> (lua_touserdata (L, index));
-        }
-        else
+        lua_rawgetp (L, LUA_REGISTRYINDEX, getKey ());
+        bool const isEnabled = lua_istable (L, -1);
+        lua_pop (L, 1);
+        if (!isEnabled)
         {
-          rawgetfield (L, -2, "__const");
-          if (lua_rawequal (L, -1, -2))
-          {
-            // Matches const table
-            lua_pop (L, 3);
-            ud = static_cast <Userdata*> (lua_touserdata (L, index));
-          }
-          else
+          lua_createtable (L, 2, 0);
+          for (int kind = 1; kind <= 2; ++kind)
           {
-            // Mismatch, but its one of ours so get a type name.
-            rawgetfield (L, -2, "__type");
-            lua_insert (L, -4);
-            lua_pop (L, 2);
-            got = lua_tostring (L, -2);
-            mismatch = true;
+            lua_newtable (L);
+            lua_rawseti (L, -2, kind);
           }
+          lua_rawsetp (L, LUA_REGISTRYINDEX, getKey ());
         }
       }
-
-      if (mismatch)
+      else
       {
-        rawgetfield (L, -1, "__type");
-        assert (lua_type (L, -1) == LUA_TSTRING);
-        char const* const expected = lua_tostring (L, -1);
-
-        if (got == 0)
-          got = lua_typename (L, lua_type (L, index));
-
-        char const* const msg = lua_pushfstring (
-          L, "%s expected, got %s", expected, got);
-
-        if (narg > 0)
-          luaL_argerror (L, narg, msg);
-        else
-          lua_error (L);
+        lua_pushnil (L);
+        lua_rawsetp (L, LUA_REGISTRYINDEX, getKey ());
       }
-
-      return ud;
     }
 
     //--------------------------------------------------------------------------
     /**
-      Validate and retrieve a Userdata on the stack.
+      Push the cached userdata for an object.
 
-      The Userdata must be derived from or the same as the given base class,
-      identified by the key. If canBeConst is false, generates an error if
-      the resulting Userdata represents to a const object. We do the type check
-      first so that the error message is informative.
+      If the cache is enabled and holds a userdata for the object pointer,
+      the metatable key and the kind, the userdata is pushed and the return
+      value is true. Otherwise, nothing is pushed.
     */
-    static Userdata* getClass (
-      lua_State* L, int const index, void const* const baseClassKey, bool const canBeConst)
+    static bool push (lua_State* L, Kind kind, void const* key, void const* p)
     {
-      assert (index > 0);
-      Userdata* ud = 0;
-
-      bool mismatch = false;
-      char const* got = 0;
+      lua_rawgetp (L, LUA_REGISTRYINDEX, getKey ());
+      if (lua_isnil (L, -1))
+      {
+        lua_pop (L, 1);
+        return false;
+      }
 
-      lua_rawgetp (L, LUA_REGISTRYINDEX, baseClassKey);
-      assert (lua_istable (L, -1));
+      lua_rawgeti (L, -1, kind + 1);
+      lua_rawgetp (L, -1, key);
+      if (lua_isnil (L, -1))
+      {
+        lua_pop (L, 3);
+        return false;
+      }
 
-      // Make sure we have a userdata.
-      if (lua_isuserdata (L, index))
+      lua_rawgetp (L, -1, p);
+      if (lua_isnil (L, -1))
       {
-        // Make sure it's metatable is ours.
-        lua_getmetatable (L, index);
-        lua_rawgetp (L, -1, getIdentityKey ());
-        if (lua_isboolean (L, -1))
-        {
-          lua_pop (L, 1);
+        lua_pop (L, 4);
+        return false;
+      }
 
-          // If __const is present, object is NOT const.
-          rawgetfield (L, -1, "__const");
-          assert (lua_istable (L, -1) || lua_isnil (L, -1));
-          bool const isConst = lua_isnil (L, -1);
-          lua_pop (L, 1);
+      lua_replace (L, -4);
+      lua_pop (L, 2);
+      return true;
+    }
 
-          // Replace the class table with the const table if needed.
-          if (isConst)
-          {
-            rawgetfield (L, -2, "__const");
-            assert (lua_istable (L, -1));
-            lua_replace (L, -3);
-          }
+    //--------------------------------------------------------------------------
+    /**
+      Remember the userdata on top of the stack for an object.
 
-          for (;;)
-          {
-            if (lua_rawequal (L, -1, -2))
-            {
-              lua_pop (L, 2);
-
-              // Match, now check const-ness.
-              if (isConst && !canBeConst)
-              {
-                luaL_argerror (L, index, "cannot be const");
-              }
-              else
-              {
-                ud = static_cast <Userdata*> (lua_touserdata (L, index));
-                break;
-              }
-            }
-            else
-            {
-              // Replace current metatable with it's base class.
-              rawgetfield (L, -1, "__parent");
-              lua_remove (L, -2);
-
-              if (lua_isnil (L, -1))
-              {
-                // Mismatch, but its one of ours so get a type name.
-                rawgetfield (L, -2, "__type");
-                lua_insert (L, -4);
-                lua_pop (L, 2);
-                got = lua_tostring (L, -2);
-                mismatch = true;
-                break;
-              }
-            }
-          }
-        }
-        else
-        {
-          lua_pop (L, 2);
-          mismatch = true;
-        }      
-      }
-      else
+      Nothing happens if the cache is disabled.
+    */
+    static void insert (lua_State* L, Kind kind, void const* key, void const* p)
+    {
+      lua_rawgetp (L, LUA_REGISTRYINDEX, getKey ());
+      if (lua_isnil (L, -1))
       {
-        mismatch = true;
+        lua_pop (L, 1);
+        return;
       }
 
-      if (mismatch)
+      lua_rawgeti (L, -1, kind + 1);
+      lua_rawgetp (L, -1, key);
+      if (lua_isnil (L, -1))
       {
-        rawgetfield (L, -1, "__type");
-        assert (lua_type (L, -1) == LUA_TSTRING);
-        char const* const expected = lua_tostring (L, -1);
+        lua_pop (L, 1);
+        lua_newtable (L);
+        lua_createtable (L, 0, 1);
+        lua_pushliteral (L, "v");
+        rawsetfield (L, -2, "__mode");
+        lua_setmetatable (L, -2);
+        lua_pushvalue (L, -1);
+        lua_rawsetp (L, -3, key);
+      }
 
-        if (got == 0)
-          got = lua_typename (L, lua_type (L, index));
+      lua_pushvalue (L, -4);
+      lua_rawsetp (L, -2, p);
+      lua_pop (L, 3);
+    }
 
-        char const* const msg = lua_pushfstring (
-          L, "%s expected, got %s", expected, got);
+  private:
+    static void const* getKey ()
+    {
+      static char value;
+      return &value;
+    }
+  };
 
-        luaL_argerror (L, index, msg);
-      }
+  //============================================================================
+  /**
+    Interface to a class poiner retrievable from a userdata.
+  */
+  class Userdata
+  {
+  protected:
+    void* m_p; // subclasses must set this
 
-      return ud;
-    }
+    /**
+      Destroys the contained object, or null if there is nothing to do.
 
-  public:
-    virtual ~Userdata () { }
+      Subclasses must set this. It takes the place of a virtual destructor,
+      so the userdata carries no vtable and __gc makes a direct call.
+    */
+    void (*m_destroy) (Userdata*);
 
     //--------------------------------------------------------------------------
     /**
-      Returns the Userdata* if the class on the Lua stack matches.
-
-      If the class does not match, a Lua error is raised.
+      Get an untyped pointer to the contained class.
     */
-    template <class T>
-    static inline Userdata* getExact (lua_State* L, int index)
+    inline void* const getPointer ()
     {
-      return getExactClass (L, index, ClassInfo <T>::getClassKey ());
+      return m_p;
     }
 
+  private:
     //--------------------------------------------------------------------------
     /**
-      Get a pointer to the class from the Lua stack.
+      Get the Ancestry of a userdata on the stack.
 
-      If the object is not the class or a subclass, or it violates the
-      const-ness, a Lua error is raised.
+      Returns null if the value is not a userdata created by LuaBridge.
     */
-    template <class T>
-    static inline T* get (lua_State* L, int index, bool canBeConst)
+    static Ancestry const* getAncestry (lua_State* L, int index)
     {
-      if (lua_isnil (L, index))
-        return 0;
-      else
-        return static_cast <T*> (getClass (L, index,
-          ClassInfo <T>::getClassKey (), canBeConst)->getPointer ());
+      Ancestry const* a = 0;
+      if (lua_isuserdata (L, index) && lua_getmetatable (L, index))
+      {
+        a = Ancestry::get (L, -1);
+        lua_pop (L, 1);
+      }
+      return a;
+    }
+
+    //--------------------------------------------------------------------------
+    /**
+      Raise a Lua error for an object that does not match the expected class.
+
+      If the object is one of ours, the message includes its type name.
+    */
+    static void mismatchError (lua_State* L, int narg, void const* const classKey)
+    {
+      int const index = lua_absindex (L, narg);
+
+      lua_rawgetp (L, LUA_REGISTRYINDEX, classKey);
+      assert (lua_istable (L, -1));
+      lua_rawgetp (L, -1, getTypeKey ());
+      assert (lua_type (L, -1) == LUA_TSTRING);
+      char const* const expected = lua_tostring (L, -1);
+
+      char const* got;
+      if (getAncestry (L, index) != 0)
+      {
+        lua_getmetatable (L, index);
+        lua_rawgetp (L, -1, getTypeKey ());
+        got = lua_tostring (L, -1);
+      }
+      else
+      {
+        got = lua_typename (L, lua_type (L, index));
+      }
+
+      char const* const msg = lua_pushfstring (
+        L, "%s expected, got %s", expected, got);
+
+      if (narg > 0)
+        luaL_argerror (L, narg, msg);
+      else
+        lua_error (L);
+    }
+
+    //--------------------------------------------------------------------------
+    /**
+      Validate and retrieve a Userdata on the stack.
+
+      The Userdata must exactly match the corresponding class table or
+      const table, or else a Lua error is raised. This is used for the
+      __gc metamethod.
+    */
+    static Userdata* getExactClass (lua_State* L, int narg, void const* const classKey)
+    {
+      Ancestry const* const ancestry = getAncestry (L, narg);
+
+      if (ancestry == 0 || ancestry->keys [0] != classKey)
+        mismatchError (L, narg, classKey);
+
+      return static_cast <Userdata*> (lua_touserdata (L, narg));
+    }
+
+    //--------------------------------------------------------------------------
+    /**
+      Validate and retrieve a Userdata on the stack.
+
+      The Userdata must be derived from or the same as the given base class,
+      identified by the key. If canBeConst is false, generates an error if
+      the resulting Userdata represents to a const object. We do the type check
+      first so that the error message is informative.
+    */
+    static Userdata* getClass (
+      lua_State* L, int const index, void const* const baseClassKey, bool const canBeConst)
+    {
+      assert (index > 0);
+      Ancestry const* const ancestry = getAncestry (L, index);
+
+      if (ancestry == 0 || !ancestry->isDerivedFrom (baseClassKey))
+        mismatchError (L, index, baseClassKey);
+      else if (ancestry->isConst && !canBeConst)
+        luaL_argerror (L, index, "cannot be const");
+
+      return static_cast <Userdata*> (lua_touserdata (L, index));
+    }
+
+  public:
+    //--------------------------------------------------------------------------
+    /**
+      Returns true if the contained object is destroyed by the given function.
+
+      This tells what kind of Userdata subclass holds the object.
+    */
+    inline bool isDestroyedBy (void (*destroy) (Userdata*)) const
+    {
+      return m_destroy == destroy;
+    }
+
+    //--------------------------------------------------------------------------
+    /**
+      Destroy the contained object. This is used for the __gc metamethod.
+    */
+    inline void destroy ()
+    {
+      if (m_destroy != 0)
+        m_destroy (this);
+    }
+
+    //--------------------------------------------------------------------------
+    /**
+      __gc metamethod for a class.
+    */
+    template <class T>
+    static int gcMetaMethod (lua_State* L)
+    {
+      getExact <T> (L, 1)->destroy ();
+      return 0;
+    }
+
+    //--------------------------------------------------------------------------
+    /**
+      Install the __gc metamethod in a class table or const table of T.
+
+      A userdata only pays for finalization if its metatable has __gc, so
+      this is done when the first userdata which needs it is created. For
+      Lua 5.2 it must happen before the metatable is set on the userdata.
+    */
+    template <class T>
+    static void setFinalizer (lua_State* L, int index)
+    {
+      Ancestry* const ancestry = Ancestry::get (L, index);
+      assert (ancestry != 0);
+      if (!ancestry->hasFinalizer)
+      {
+        index = lua_absindex (L, index);
+        lua_pushcfunction (L, &gcMetaMethod <T>);
+        rawsetfield (L, index, "__gc");
+        ancestry->hasFinalizer = true;
+      }
+    }
+
+    //--------------------------------------------------------------------------
+    /**
+      Returns the Userdata* if the class on the Lua stack matches.
+
+      If the class does not match, a Lua error is raised.
+    */
+    template <class T>
+    static inline Userdata* getExact (lua_State* L, int index)
+    {
+      return getExactClass (L, index, ClassInfo <T>::getClassKey ());
+    }
+
+    //--------------------------------------------------------------------------
+    /**
+      Get a pointer to the class from the Lua stack.
+
+      If the object is not the class or a subclass, or it violates the
+      const-ness, a Lua error is raised.
+    */
+    template <class T>
+    static inline T* get (lua_State* L, int index, bool canBeConst)
+    {
+      if (lua_isnil (L, index))
+        return 0;
+      else
+        return static_cast <T*> (getClass (L, index,
+          ClassInfo <T>::getClassKey (), canBeConst)->getPointer ());
+    }
+
+    //--------------------------------------------------------------------------
+    /**
+      Get a pointer to the class from the Lua stack, without any checks.
+
+      The value must be nil, or a userdata created by LuaBridge for the class
+      or a subclass. This is used for unchecked calls.
+    */
+    template <class T>
+    static inline T* getUnchecked (lua_State* L, int index)
+    {
+      Userdata* const ud = static_cast <Userdata*> (lua_touserdata (L, index));
+      return ud != 0 ? static_cast <T*> (ud->getPointer ()) : 0;
     }
   };
 
@@ -2652,11 +3037,12 @@ namespace Detail
     UserdataValue ()
     {
       m_p = getObject ();
+      m_destroy = TypeTraits::isTriviallyDestructible <T>::value ? 0 : &destroyObject;
     }
 
-    ~UserdataValue ()
+    static void destroyObject (Userdata* ud)
     {
-      getObject ()->~T ();
+      static_cast <UserdataValue <T>*> (ud)->getObject ()->~T ();
     }
 
   public:
@@ -2706,11 +3092,14 @@ namespace Detail
     {
       if (p)
       {
+        if (IdentityCache::push (L, IdentityCache::pointer, key, p))
+          return;
         new (lua_newuserdata (L, sizeof (UserdataPtr))) UserdataPtr (p);
         lua_rawgetp (L, LUA_REGISTRYINDEX, key);
         // If this goes off it means you forgot to register the class!
         assert (lua_istable (L, -1));
         lua_setmetatable (L, -2);
+        IdentityCache::insert (L, IdentityCache::pointer, key, p);
       }
       else
       {
@@ -2724,12 +3113,15 @@ namespace Detail
     {
       if (p)
       {
+        if (IdentityCache::push (L, IdentityCache::pointer, key, p))
+          return;
         new (lua_newuserdata (L, sizeof (UserdataPtr)))
           UserdataPtr (const_cast <void*> (p));
         lua_rawgetp (L, LUA_REGISTRYINDEX, key);
         // If this goes off it means you forgot to register the class!
         assert (lua_istable (L, -1));
         lua_setmetatable (L, -2);
+        IdentityCache::insert (L, IdentityCache::pointer, key, p);
       }
       else
       {
@@ -2740,6 +3132,7 @@ namespace Detail
     explicit UserdataPtr (void* const p)
     {
       m_p = p;
+      m_destroy = 0;
 
       // Can't construct with a null pointer!
       //
@@ -2794,6 +3187,11 @@ namespace Detail
     {
     }
 
+    static void destroyContainer (Userdata* ud)
+    {
+      static_cast <UserdataShared <C>*> (ud)->~UserdataShared ();
+    }
+
   public:
     /**
       Construct from a container to the class or a derived class.
@@ -2803,6 +3201,7 @@ namespace Detail
     {
       m_p = const_cast <void*> (reinterpret_cast <void const*> (
           (ContainerTraits <C>::get (m_c))));
+      m_destroy = &destroyContainer;
     }
 
     /**
@@ -2813,91 +3212,208 @@ namespace Detail
     {
       m_p = const_cast <void*> (reinterpret_cast <void const*> (
           (ContainerTraits <C>::get (m_c))));
+      m_destroy = &destroyContainer;
+    }
+
+#if LUABRIDGE_COMPILER_SUPPORTS_MOVE_SEMANTICS
+    /**
+      Construct by taking over a container.
+    */
+    explicit UserdataShared (C&& c) : m_c (std::move (c))
+    {
+      m_p = const_cast <void*> (reinterpret_cast <void const*> (
+          (ContainerTraits <C>::get (m_c))));
+      m_destroy = &destroyContainer;
+    }
+#endif
+
+    /**
+      Get a container for the class object on the Lua stack.
+
+      The container is made from the raw pointer, so it must keep its
+      reference count in the object or in a table of its own.
+    */
+    static C get (lua_State* L, int index)
+    {
+      return Userdata::get <T> (L, index, true);
     }
   };
 
+#if LUABRIDGE_HAS_STD_SHARED_PTR
   //----------------------------------------------------------------------------
-  //
-  // SFINAE helpers.
-  //
+  /**
+    Wraps a std::shared_ptr that references a class object.
 
-  // non-const objects
-  template <class C, bool makeObjectConst>
-  struct UserdataSharedHelper
+    Whatever the type that was pushed, the userdata holds a std::shared_ptr
+    to void which shares its ownership. A std::shared_ptr to the class or a
+    base class is rebuilt from it with the aliasing constructor, so the
+    object keeps a single reference count.
+  */
+  class UserdataSharedPtr : public Userdata
   {
-    typedef typename TypeTraits::removeConst <
-      typename ContainerTraits <C>::Type>::Type T;
+  private:
+    UserdataSharedPtr (UserdataSharedPtr const&);
+    UserdataSharedPtr& operator= (UserdataSharedPtr const&);
 
-    static void push (lua_State* L, C const& c)
+    std::shared_ptr <void const> m_owner;
+
+    static void destroyContainer (Userdata* ud)
     {
-      if (ContainerTraits <C>::get (c) != 0)
-      {
-        new (lua_newuserdata (L, sizeof (UserdataShared <C>))) UserdataShared <C> (c);
-        lua_rawgetp (L, LUA_REGISTRYINDEX, ClassInfo <T>::getClassKey ());
-        // If this goes off it means the class T is unregistered!
-        assert (lua_istable (L, -1));
-        lua_setmetatable (L, -2);
-      }
-      else
-      {
-        lua_pushnil (L);
-      }
+      static_cast <UserdataSharedPtr*> (ud)->~UserdataSharedPtr ();
     }
 
-    static void push (lua_State* L, T* const t)
+  protected:
+    ~UserdataSharedPtr ()
     {
-      if (t)
-      {
-        new (lua_newuserdata (L, sizeof (UserdataShared <C>))) UserdataShared <C> (t);
-        lua_rawgetp (L, LUA_REGISTRYINDEX, ClassInfo <T>::getClassKey ());
-        // If this goes off it means the class T is unregistered!
-        assert (lua_istable (L, -1));
-        lua_setmetatable (L, -2);
-      }
-      else
+    }
+
+    template <class U>
+    explicit UserdataSharedPtr (std::shared_ptr <U> const& u) : m_owner (u)
+    {
+      m_p = const_cast <void*> (static_cast <void const*> (u.get ()));
+      m_destroy = &destroyContainer;
+    }
+
+#if LUABRIDGE_COMPILER_SUPPORTS_MOVE_SEMANTICS
+    template <class U>
+    explicit UserdataSharedPtr (std::shared_ptr <U>&& u)
+      : m_owner (std::move (u))
+    {
+      m_p = const_cast <void*> (m_owner.get ());
+      m_destroy = &destroyContainer;
+    }
+#endif
+
+  public:
+    /**
+      Get a std::shared_ptr to the class object on the Lua stack.
+
+      The object must be nil or have been pushed in a std::shared_ptr, or
+      else a Lua error is raised.
+    */
+    template <class T>
+    static std::shared_ptr <T> get (lua_State* L, int index)
+    {
+      T* const t = Userdata::get <T> (L, index, true);
+      if (t == 0)
+        return std::shared_ptr <T> ();
+
+      Userdata* const ud = static_cast <Userdata*> (lua_touserdata (L, index));
+      if (!ud->isDestroyedBy (&destroyContainer))
       {
-        lua_pushnil (L);
+        luaL_argerror (L, index, "not held by a std::shared_ptr");
+        return std::shared_ptr <T> ();
       }
+
+      return std::shared_ptr <T> (
+        static_cast <UserdataSharedPtr*> (ud)->m_owner, t);
     }
   };
 
-  // const objects
-  template <class C>
-  struct UserdataSharedHelper <C, true>
+  /**
+    Wraps a std::shared_ptr that references a class object.
+  */
+  template <class U>
+  class UserdataShared <std::shared_ptr <U> > : public UserdataSharedPtr
+  {
+  private:
+    typedef typename TypeTraits::removeConst <U>::Type T;
+
+    ~UserdataShared ()
+    {
+    }
+
+  public:
+    /**
+      Construct from a container to the class or a derived class.
+    */
+    explicit UserdataShared (std::shared_ptr <U> const& u)
+      : UserdataSharedPtr (u)
+    {
+    }
+
+#if LUABRIDGE_COMPILER_SUPPORTS_MOVE_SEMANTICS
+    /**
+      Construct by taking over a container.
+    */
+    explicit UserdataShared (std::shared_ptr <U>&& u)
+      : UserdataSharedPtr (std::move (u))
+    {
+    }
+#endif
+
+    /**
+      Construct from a new object, which the container will own.
+    */
+    explicit UserdataShared (T* t)
+      : UserdataSharedPtr (std::shared_ptr <T> (t))
+    {
+    }
+
+    static std::shared_ptr <U> get (lua_State* L, int index)
+    {
+      return UserdataSharedPtr::get <T> (L, index);
+    }
+  };
+#endif
+
+  //----------------------------------------------------------------------------
+  /**
+    Push a class object held in a container.
+
+    If makeObjectConst is true, the object is pushed with the const table.
+  */
+  template <class C, bool makeObjectConst>
+  struct UserdataSharedHelper
   {
     typedef typename TypeTraits::removeConst <
       typename ContainerTraits <C>::Type>::Type T;
 
     static void push (lua_State* L, C const& c)
     {
-      if (ContainerTraits <C>::get (c) != 0)
-      {
-        new (lua_newuserdata (L, sizeof (UserdataShared <C>))) UserdataShared <C> (c);
-        lua_rawgetp (L, LUA_REGISTRYINDEX, ClassInfo <T>::getConstKey ());
-        // If this goes off it means the class T is unregistered!
-        assert (lua_istable (L, -1));
-        lua_setmetatable (L, -2);
-      }
-      else
-      {
-        lua_pushnil (L);
-      }
+      pushUserdata <C const&> (L, const_cast <T*> (ContainerTraits <C>::get (c)), c);
+    }
+
+#if LUABRIDGE_COMPILER_SUPPORTS_MOVE_SEMANTICS
+    static void push (lua_State* L, C&& c)
+    {
+      pushUserdata <C&&> (L, const_cast <T*> (ContainerTraits <C>::get (c)), std::move (c));
     }
+#endif
 
     static void push (lua_State* L, T* const t)
     {
-      if (t)
-      {
-        new (lua_newuserdata (L, sizeof (UserdataShared <C>))) UserdataShared <C> (t);
-        lua_rawgetp (L, LUA_REGISTRYINDEX, ClassInfo <T>::getConstKey ());
-        // If this goes off it means the class T is unregistered!
-        assert (lua_istable (L, -1));
-        lua_setmetatable (L, -2);
-      }
-      else
+      pushUserdata <T*> (L, t, t);
+    }
+
+  private:
+    /**
+      Push the userdata for t, or nil if t is null.
+
+      A userdata from the identity cache is pushed if there is one, or else
+      a new UserdataShared is made from arg, which is a C const&, C&& or T*.
+    */
+    template <class Arg>
+    static void pushUserdata (lua_State* L, T* const t, Arg arg)
+    {
+      if (t == 0)
       {
         lua_pushnil (L);
+        return;
       }
+
+      void const* const key = makeObjectConst ?
+        ClassInfo <T>::getConstKey () : ClassInfo <T>::getClassKey ();
+      if (IdentityCache::push (L, IdentityCache::container, key, t))
+        return;
+      new (lua_newuserdata (L, sizeof (UserdataShared <C>))) UserdataShared <C> (
+        static_cast <Arg> (arg));
+      lua_rawgetp (L, LUA_REGISTRYINDEX, key);
+      // If this goes off it means the class T is unregistered!
+      assert (lua_istable (L, -1));
+      Userdata::setFinalizer <T> (L, -1);
+      lua_setmetatable (L, -2);
+      IdentityCache::insert (L, IdentityCache::container, key, t);
     }
   };
 
@@ -2906,9 +3422,10 @@ namespace Detail
 
     The container controls the object lifetime. Typically this will be a
     lifetime shared by C++ and Lua using a reference count. Because of type
-    erasure, containers like std::shared_ptr will not work. Containers must
-    either be of the intrusive variety, or in the style of the RefCountedPtr
-    type provided by LuaBridge (that uses a global hash table).
+    erasure, a container is rebuilt from a raw pointer when it comes back
+    from Lua. Containers must either be of the intrusive variety, or in the
+    style of the RefCountedPtr type provided by LuaBridge (that uses a global
+    hash table). std::shared_ptr is the exception, see UserdataSharedPtr.
   */
   template <class C, bool byContainer>
   struct StackHelper
@@ -2919,12 +3436,20 @@ namespace Detail
         TypeTraits::isConst <typename ContainerTraits <C>::Type>::value>::push (L, c);
     }
 
-    typedef typename TypeTraits::removeConst <
-      typename ContainerTraits <C>::Type>::Type T;
-
-    static inline C get (lua_State* L, int index)
+#if LUABRIDGE_COMPILER_SUPPORTS_MOVE_SEMANTICS
+    static inline void push (lua_State* L, C&& c)
     {
-      return Detail::Userdata::get <T> (L, index, true);
+      UserdataSharedHelper <C,
+        TypeTraits::isConst <typename ContainerTraits <C>::Type>::value>::push (L, std::move (c));
+    }
+#endif
+
+    typedef typename TypeTraits::removeConst <
+      typename ContainerTraits <C>::Type>::Type T;
+
+    static inline C get (lua_State* L, int index)
+    {
+      return UserdataShared <C>::get (L, index);
     }
   };
 
@@ -2948,6 +3473,77 @@ namespace Detail
       return *Detail::Userdata::get <T> (L, index, true);
     }
   };
+
+  //----------------------------------------------------------------------------
+  /**
+    Lua stack conversions for integral types.
+
+    Types whose values all fit in a lua_Integer are pushed as integers.
+    Wider types, such as a 64-bit unsigned integer, go through lua_Number.
+    Arguments are read as a lua_Number, whose range is checked before it is
+    converted: a number outside the range of T raises an error, since
+    converting it would be undefined behavior in C++. A fraction is
+    truncated toward zero. Note that Lua 5.1 and 5.2 store every number as
+    a lua_Number, so integers beyond 2^53 lose precision in Lua itself.
+
+    If LUABRIDGE_TRUSTED_INTEGERS is defined to 1, integral arguments are read
+    without any checks, and a value that is not a number reads as zero. Only
+    use this when all scripts are trusted.
+  */
+  template <class T>
+  struct IntegerStack
+  {
+    typedef std::numeric_limits <T> Limits;
+
+    static bool const isSigned = Limits::is_signed;
+
+    static bool const fitsInteger = sizeof (T) < sizeof (lua_Integer) ||
+      (sizeof (T) == sizeof (lua_Integer) && isSigned);
+
+    static inline void push (lua_State* L, T value)
+    {
+      if (fitsInteger)
+        lua_pushinteger (L, static_cast <lua_Integer> (value));
+      else
+        lua_pushnumber (L, static_cast <lua_Number> (value));
+    }
+
+    static inline T getUnchecked (lua_State* L, int index)
+    {
+      if (fitsInteger)
+        return static_cast <T> (lua_tointeger (L, index));
+      else
+        return static_cast <T> (lua_tonumber (L, index));
+    }
+
+    static inline T get (lua_State* L, int index)
+    {
+#if LUABRIDGE_TRUSTED_INTEGERS
+      return getUnchecked (L, index);
+#else
+      // luaL_checkinteger would convert before any check could run. The
+      // fraction is dropped first, so that the range applies to the value
+      // which is actually converted.
+      // Limits::max () + 1 is a power of two, and exact as a lua_Number,
+      // and so is Limits::min (). A NaN fails both comparisons.
+      lua_Number const value = luaL_checknumber (L, index);
+      lua_Number const truncated = value < 0 ? std::ceil (value) : std::floor (value);
+      lua_Number const limit = (static_cast <lua_Number> (Limits::max () / 2) + 1) * 2;
+      if (!(truncated >= (isSigned ? -limit : 0) && truncated < limit))
+        luaL_argerror (L, index, "number is out of range");
+      return static_cast <T> (truncated);
+#endif
+    }
+  };
+
+  template <class T>
+  struct UncheckedIntegerStack
+  {
+    static inline T get (lua_State* L, int index)
+    {
+      return IntegerStack <T>::getUnchecked (L, index);
+    }
+  };
 }
 
 //==============================================================================
@@ -2965,6 +3561,15 @@ public:
       Detail::TypeTraits::isContainer <T>::value>::push (L, t);
   }
 
+#if LUABRIDGE_COMPILER_SUPPORTS_MOVE_SEMANTICS
+  /** Containers are moved into the userdata, other values are copied. */
+  static inline void push (lua_State* L, T&& t)
+  {
+    Detail::StackHelper <T,
+      Detail::TypeTraits::isContainer <T>::value>::push (L, std::move (t));
+  }
+#endif
+
   static inline T get (lua_State* L, int index)
   {
     return Detail::StackHelper <T,
@@ -3096,53 +3701,58 @@ struct Stack <lua_State*>
 */
 
 // int
-template <> struct Stack <
-  int > { static inline void push (lua_State* L,
-  int value) { lua_pushnumber (L, static_cast <lua_Number> (value)); } static inline
-  int get (lua_State* L, int index) { return static_cast <
-  int > (luaL_checknumber (L, index)); } };
+template <>
+struct Stack <int> : Detail::IntegerStack <int>
+{
+};
 
 // unsigned int
-template <> struct Stack <
-  unsigned int > { static inline void push (lua_State* L,
-  unsigned int value) { lua_pushnumber (L, static_cast <lua_Number> (value)); } static inline
-  unsigned int get (lua_State* L, int index) { return static_cast <
-  unsigned int > (luaL_checknumber (L, index)); } };
+template <>
+struct Stack <unsigned int> : Detail::IntegerStack <unsigned int>
+{
+};
 
 // unsigned char
-template <> struct Stack <
-  unsigned char > { static inline void push (lua_State* L,
-  unsigned char value) { lua_pushnumber (L, static_cast <lua_Number> (value)); } static inline
-  unsigned char get (lua_State* L, int index) { return static_cast <
-  unsigned char > (luaL_checknumber (L, index)); } };
+template <>
+struct Stack <unsigned char> : Detail::IntegerStack <unsigned char>
+{
+};
 
 // short
-template <> struct Stack <
-  short > { static inline void push (lua_State* L,
-  short value) { lua_pushnumber (L, static_cast <lua_Number> (value)); } static inline
-  short get (lua_State* L, int index) { return static_cast <
-  short > (luaL_checknumber (L, index)); } };
+template <>
+struct Stack <short> : Detail::IntegerStack <short>
+{
+};
 
 // unsigned short
-template <> struct Stack <
-  unsigned short > { static inline void push (lua_State* L,
-  unsigned short value) { lua_pushnumber (L, static_cast <lua_Number> (value)); } static inline
-  unsigned short get (lua_State* L, int index) { return static_cast <
-  unsigned short > (luaL_checknumber (L, index)); } };
+template <>
+struct Stack <unsigned short> : Detail::IntegerStack <unsigned short>
+{
+};
 
 // long
-template <> struct Stack <
-  long > { static inline void push (lua_State* L,
-  long value) { lua_pushnumber (L, static_cast <lua_Number> (value)); } static inline
-  long get (lua_State* L, int index) { return static_cast <
-  long > (luaL_checknumber (L, index)); } };
+template <>
+struct Stack <long> : Detail::IntegerStack <long>
+{
+};
 
 // unsigned long
-template <> struct Stack <
-  unsigned long > { static inline void push (lua_State* L,
-  unsigned long value) { lua_pushnumber (L, static_cast <lua_Number> (value)); } static inline
-  unsigned long get (lua_State* L, int index) { return static_cast <
-  unsigned long > (luaL_checknumber (L, index)); } };
+template <>
+struct Stack <unsigned long> : Detail::IntegerStack <unsigned long>
+{
+};
+
+// long long
+template <>
+struct Stack <long long> : Detail::IntegerStack <long long>
+{
+};
+
+// unsigned long long
+template <>
+struct Stack <unsigned long long> : Detail::IntegerStack <unsigned long long>
+{
+};
 
 // float
 template <> struct Stack <
@@ -3181,8 +3791,7 @@ struct Stack <char>
 {
   static inline void push (lua_State* L, char value)
   {
-    char str [2] = { value, 0 };
-    lua_pushstring (L, str);
+    lua_pushlstring (L, &value, 1);
   }
 
   static inline char get (lua_State* L, int index)
@@ -3212,61 +3821,402 @@ struct Stack <char const*>
   }
 };
 
-// std::string
+// std::string
+template <>
+struct Stack <std::string>
+{
+  static inline void push (lua_State* L, std::string const& str)
+  {
+    lua_pushlstring (L, str.data (), str.size ());
+  }
+
+  static inline std::string get (lua_State* L, int index)
+  {
+    size_t len;
+    char const* const str = luaL_checklstring (L, index, &len);
+    return std::string (str, len);
+  }
+};
+
+// std::string const&
+template <>
+struct Stack <std::string const&>
+{
+  static inline void push (lua_State* L, std::string const& str)
+  {
+    lua_pushlstring (L, str.data (), str.size ());
+  }
+
+  static inline std::string get (lua_State* L, int index)
+  {
+    size_t len;
+    char const* const str = luaL_checklstring (L, index, &len);
+    return std::string (str, len);
+  }
+};
+
+//------------------------------------------------------------------------------
+/**
+  A string which is not owned, with an explicit length.
+
+  As a parameter type of a registered function, it points directly into the
+  Lua string without copying it. The Lua string stays on the stack, so the
+  characters are valid until the function returns, but must not be kept after
+  that. Embedded zeroes are preserved, and the data is always followed by a
+  terminating zero.
+*/
+class StringView
+{
+public:
+  StringView () : m_data (""), m_size (0)
+  {
+  }
+
+  StringView (char const* data, size_t size) : m_data (data), m_size (size)
+  {
+  }
+
+  StringView (std::string const& str) : m_data (str.c_str ()), m_size (str.size ())
+  {
+  }
+
+  char const* data () const
+  {
+    return m_data;
+  }
+
+  size_t size () const
+  {
+    return m_size;
+  }
+
+  bool empty () const
+  {
+    return m_size == 0;
+  }
+
+  char const* begin () const
+  {
+    return m_data;
+  }
+
+  char const* end () const
+  {
+    return m_data + m_size;
+  }
+
+  char operator[] (size_t i) const
+  {
+    return m_data [i];
+  }
+
+  std::string str () const
+  {
+    return std::string (m_data, m_size);
+  }
+
+private:
+  char const* m_data;
+  size_t m_size;
+};
+
+// StringView
+template <>
+struct Stack <StringView>
+{
+  static inline void push (lua_State* L, StringView str)
+  {
+    lua_pushlstring (L, str.data (), str.size ());
+  }
+
+  static inline StringView get (lua_State* L, int index)
+  {
+    size_t len;
+    char const* const str = luaL_checklstring (L, index, &len);
+    return StringView (str, len);
+  }
+};
+
+// StringView const&
+template <>
+struct Stack <StringView const&>
+{
+  static inline void push (lua_State* L, StringView const& str)
+  {
+    lua_pushlstring (L, str.data (), str.size ());
+  }
+
+  static inline StringView get (lua_State* L, int index)
+  {
+    size_t len;
+    char const* const str = luaL_checklstring (L, index, &len);
+    return StringView (str, len);
+  }
+};
+
+//==============================================================================
+/**
+  Subclass of a TypeListValues constructable from the Lua stack.
+*/
+
+template <typename List, int Start = 1>
+struct ArgList
+{
+};
+
+template <int Start>
+struct ArgList <None, Start> : public TypeListValues <None>
+{
+  ArgList (lua_State*)
+  {
+  }
+};
+
+template <typename Head, typename Tail, int Start>
+struct ArgList <TypeList <Head, Tail>, Start>
+  : public TypeListValues <TypeList <Head, Tail> >
+{
+  ArgList (lua_State* L)
+    : TypeListValues <TypeList <Head, Tail> > (Stack <Head>::get (L, Start),
+                                            ArgList <Tail, Start + 1> (L))
+  {
+  }
+};
+
+//==============================================================================
+/**
+  Policy tag for registering an unchecked function.
+
+  Passing Unchecked () as the last argument of addFunction registers a call
+  which does not validate its arguments. The object is taken from the first
+  argument without checking its class or const-ness, and arguments of basic
+  types are read with the lua_to* functions, which do not raise errors. Other
+  argument types are converted as usual.
+
+  A call with the wrong arguments is undefined behavior, so use this only for
+  functions which are called from trusted scripts.
+*/
+struct Unchecked
+{
+};
+
+//------------------------------------------------------------------------------
+/**
+  Lua stack conversions for the arguments of unchecked calls.
+
+  Types without a specialization use the checked Stack conversion.
+*/
+template <class T>
+struct UncheckedStack
+{
+  static inline T get (lua_State* L, int index)
+  {
+    return Stack <T>::get (L, index);
+  }
+};
+
+template <class T>
+struct UncheckedStack <T*>
+{
+  static inline T* get (lua_State* L, int index)
+  {
+    return Detail::Userdata::getUnchecked <T> (L, index);
+  }
+};
+
+template <class T>
+struct UncheckedStack <T* const>
+{
+  static inline T* get (lua_State* L, int index)
+  {
+    return Detail::Userdata::getUnchecked <T> (L, index);
+  }
+};
+
+template <class T>
+struct UncheckedStack <T const*>
+{
+  static inline T const* get (lua_State* L, int index)
+  {
+    return Detail::Userdata::getUnchecked <T> (L, index);
+  }
+};
+
+template <class T>
+struct UncheckedStack <T const* const>
+{
+  static inline T const* get (lua_State* L, int index)
+  {
+    return Detail::Userdata::getUnchecked <T> (L, index);
+  }
+};
+
+template <class T>
+struct UncheckedStack <T&>
+{
+  static inline T& get (lua_State* L, int index)
+  {
+    return *Detail::Userdata::getUnchecked <T> (L, index);
+  }
+};
+
+template <class T>
+struct UncheckedStack <T const&>
+{
+  static inline T const& get (lua_State* L, int index)
+  {
+    return *Detail::Userdata::getUnchecked <T> (L, index);
+  }
+};
+
+template <>
+struct UncheckedStack <lua_State*>
+{
+  static inline lua_State* get (lua_State* L, int)
+  {
+    return L;
+  }
+};
+
+template <>
+struct UncheckedStack <int> : Detail::UncheckedIntegerStack <int>
+{
+};
+
+template <>
+struct UncheckedStack <unsigned int> : Detail::UncheckedIntegerStack <unsigned int>
+{
+};
+
+template <>
+struct UncheckedStack <unsigned char> : Detail::UncheckedIntegerStack <unsigned char>
+{
+};
+
+template <>
+struct UncheckedStack <short> : Detail::UncheckedIntegerStack <short>
+{
+};
+
+template <>
+struct UncheckedStack <unsigned short> : Detail::UncheckedIntegerStack <unsigned short>
+{
+};
+
+template <>
+struct UncheckedStack <long> : Detail::UncheckedIntegerStack <long>
+{
+};
+
+template <>
+struct UncheckedStack <unsigned long> : Detail::UncheckedIntegerStack <unsigned long>
+{
+};
+
+template <>
+struct UncheckedStack <long long> : Detail::UncheckedIntegerStack <long long>
+{
+};
+
+template <>
+struct UncheckedStack <unsigned long long> : Detail::UncheckedIntegerStack <unsigned long long>
+{
+};
+
+template <>
+struct UncheckedStack <float>
+{
+  static inline float get (lua_State* L, int index)
+  {
+    return static_cast <float> (lua_tonumber (L, index));
+  }
+};
+
+template <>
+struct UncheckedStack <double>
+{
+  static inline double get (lua_State* L, int index)
+  {
+    return static_cast <double> (lua_tonumber (L, index));
+  }
+};
+
+template <>
+struct UncheckedStack <bool>
+{
+  static inline bool get (lua_State* L, int index)
+  {
+    return lua_toboolean (L, index) ? true : false;
+  }
+};
+
 template <>
-struct Stack <std::string>
+struct UncheckedStack <char const*>
 {
-  static inline void push (lua_State* L, std::string const& str)
+  static inline char const* get (lua_State* L, int index)
   {
-    lua_pushstring (L, str.c_str ());
+    return lua_tostring (L, index);
   }
+};
 
+template <>
+struct UncheckedStack <std::string>
+{
   static inline std::string get (lua_State* L, int index)
   {
-    return std::string (luaL_checkstring (L, index));
+    size_t len;
+    char const* const str = lua_tolstring (L, index, &len);
+    return str != 0 ? std::string (str, len) : std::string ();
   }
 };
 
-// std::string const&
 template <>
-struct Stack <std::string const&>
+struct UncheckedStack <std::string const&> : UncheckedStack <std::string>
 {
-  static inline void push (lua_State* L, std::string const& str)
-  {
-    lua_pushstring (L, str.c_str());
-  }
+};
 
-  static inline std::string get (lua_State* L, int index)
+template <>
+struct UncheckedStack <StringView>
+{
+  static inline StringView get (lua_State* L, int index)
   {
-    return std::string (luaL_checkstring (L, index));
+    size_t len;
+    char const* const str = lua_tolstring (L, index, &len);
+    return str != 0 ? StringView (str, len) : StringView ();
   }
 };
 
-//==============================================================================
+template <>
+struct UncheckedStack <StringView const&> : UncheckedStack <StringView>
+{
+};
+
+//------------------------------------------------------------------------------
 /**
-  Subclass of a TypeListValues constructable from the Lua stack.
+  Subclass of a TypeListValues constructable from the Lua stack, for
+  unchecked calls.
 */
 
 template <typename List, int Start = 1>
-struct ArgList
+struct UncheckedArgList
 {
 };
 
 template <int Start>
-struct ArgList <None, Start> : public TypeListValues <None>
+struct UncheckedArgList <None, Start> : public TypeListValues <None>
 {
-  ArgList (lua_State*)
+  UncheckedArgList (lua_State*)
   {
   }
 };
 
 template <typename Head, typename Tail, int Start>
-struct ArgList <TypeList <Head, Tail>, Start>
+struct UncheckedArgList <TypeList <Head, Tail>, Start>
   : public TypeListValues <TypeList <Head, Tail> >
 {
-  ArgList (lua_State* L)
-    : TypeListValues <TypeList <Head, Tail> > (Stack <Head>::get (L, Start),
-                                            ArgList <Tail, Start + 1> (L))
+  UncheckedArgList (lua_State* L)
+    : TypeListValues <TypeList <Head, Tail> > (UncheckedStack <Head>::get (L, Start),
+                                            UncheckedArgList <Tail, Start + 1> (L))
   {
   }
 };
@@ -3351,7 +4301,7 @@ private:
       if (lua_isnil (L, -1))                // not found
       {
         lua_pop (L, 1);                     // discard nil
-        rawgetfield (L, -1, "__propget");   // lookup __propget in metatable
+        lua_rawgetp (L, -1, Detail::getPropgetKey ()); // lookup __propget in metatable
         lua_pushvalue (L, 2);               // push key arg2
         lua_rawget (L, -2);                 // lookup key in __propget
         lua_remove (L, -2);                 // discard __propget
@@ -3377,7 +4327,7 @@ private:
         break;
       }
 
-      rawgetfield (L, -1, "__parent");
+      lua_rawgetp (L, -1, Detail::getParentKey ());
       if (lua_istable (L, -1))
       {
         // Remove metatable and repeat the search in __parent.
@@ -3410,7 +4360,7 @@ private:
     lua_getmetatable (L, 1);                // push metatable of arg1
     for (;;)
     {
-      rawgetfield (L, -1, "__propset");     // lookup __propset in metatable
+      lua_rawgetp (L, -1, Detail::getPropsetKey ()); // lookup __propset in metatable
       assert (lua_istable (L, -1));
       lua_pushvalue (L, 2);                 // push key arg2
       lua_rawget (L, -2);                   // lookup key in __propset
@@ -3429,7 +4379,7 @@ private:
         lua_pop (L, 1);
       }
 
-      rawgetfield (L, -1, "__parent");
+      lua_rawgetp (L, -1, Detail::getParentKey ());
       if (lua_istable (L, -1))
       {
         // Remove metatable and repeat the search in __parent.
@@ -3501,6 +4451,16 @@ private:
         L, FuncTraits <Func>::call (fp, args));
       return 1;
     }
+
+    static int callUnchecked (lua_State* L)
+    {
+      Func const& fp = *static_cast <Func const*> (
+        lua_touserdata (L, lua_upvalueindex (1)));
+      UncheckedArgList <Params> args (L);
+      Stack <typename FuncTraits <Func>::ReturnType>::push (
+        L, FuncTraits <Func>::call (fp, args));
+      return 1;
+    }
   };
 
   //----------------------------------------------------------------------------
@@ -3523,6 +4483,14 @@ private:
       FuncTraits <Func>::call (fp, args);
       return 0;
     }
+
+    static int callUnchecked (lua_State* L)
+    {
+      Func const& fp = *static_cast <Func const*> (lua_touserdata (L, lua_upvalueindex (1)));
+      UncheckedArgList <Params> args (L);
+      FuncTraits <Func>::call (fp, args);
+      return 0;
+    }
   };
 
   //============================================================================
@@ -3555,6 +4523,15 @@ private:
       Stack <ReturnType>::push (L, FuncTraits <MemFn>::call (t, fp, args));
       return 1;
     }
+
+    static int callUnchecked (lua_State* L)
+    {
+      T* const t = Detail::Userdata::getUnchecked <T> (L, 1);
+      MemFn fp = *static_cast <MemFn*> (lua_touserdata (L, lua_upvalueindex (1)));
+      UncheckedArgList <Params, 2> args (L);
+      Stack <ReturnType>::push (L, FuncTraits <MemFn>::call (t, fp, args));
+      return 1;
+    }
   };
 
   //----------------------------------------------------------------------------
@@ -3584,6 +4561,15 @@ private:
       FuncTraits <MemFn>::call (t, fp, args);
       return 0;
     }
+
+    static int callUnchecked (lua_State* L)
+    {
+      T* const t = Detail::Userdata::getUnchecked <T> (L, 1);
+      MemFn const fp = *static_cast <MemFn*> (lua_touserdata (L, lua_upvalueindex (1)));
+      UncheckedArgList <Params, 2> args (L);
+      FuncTraits <MemFn>::call (t, fp, args);
+      return 0;
+    }
   };
 
   //----------------------------------------------------------------------------
@@ -3610,6 +4596,261 @@ private:
     }
   };
 
+  //============================================================================
+  /**
+    Add or replace a member of a class table or const table.
+
+    The value on top of the stack is popped and stored under name in the table
+    at index, or in its sub-table under the key field (__propget or __propset)
+    if field is not null. The value is also propagated to flattened derived
+    classes which have not overridden the member.
+  */
+  static void setMember (lua_State* L, int index, void const* field, char const* name)
+  {
+    index = lua_absindex (L, index);
+    int const value = lua_gettop (L);
+
+    if (field != 0)
+      lua_rawgetp (L, index, field);
+    else
+      lua_pushvalue (L, index);
+    assert (lua_istable (L, -1));
+
+    rawgetfield (L, -1, name);              // previous value
+    lua_pushvalue (L, value);
+    rawsetfield (L, -3, name);
+
+    if (field != 0)
+      setIndexMode (L, index);
+    else
+      setMethod (L, index, name, value);
+
+    propagateMember (L, index, field, name, value + 2, value);
+
+    lua_settop (L, value - 1);
+  }
+
+  //----------------------------------------------------------------------------
+  /**
+    Store a member function in the methods table of a class table or const
+    table, if it has one. Metamethods are left out.
+  */
+  static void setMethod (lua_State* L, int index, char const* name, int value)
+  {
+    if (isMetaMethodName (name))
+      return;
+
+    lua_rawgetp (L, index, Detail::getMethodsKey ());
+    if (lua_istable (L, -1))
+    {
+      lua_pushvalue (L, value);
+      rawsetfield (L, -2, name);
+    }
+    lua_pop (L, 1);
+  }
+
+  //----------------------------------------------------------------------------
+  /**
+    Choose how members of a class table or const table are looked up.
+
+    A flat table without data members or properties holds everything that
+    can be found through it. Its member functions are then copied into a
+    methods table, __methods, which __index is set to, and the Lua VM
+    resolves member functions without calling indexMetaMethod. The methods
+    table has no metamethods, so neither they nor the class table itself
+    can be reached or changed through an object. Otherwise, __index is set
+    to indexMetaMethod.
+  */
+  static void setIndexMode (lua_State* L, int index)
+  {
+    index = lua_absindex (L, index);
+    int const top = lua_gettop (L);
+
+    Detail::Ancestry const* const ancestry = Detail::Ancestry::get (L, index);
+    assert (ancestry != 0);
+
+    lua_rawgetp (L, index, Detail::getPropgetKey ());
+    assert (lua_istable (L, -1));
+    lua_pushnil (L);
+    bool const hasProperties = lua_next (L, -2) != 0;
+    lua_settop (L, top);
+
+    if (ancestry->isFlat && !hasProperties)
+    {
+      lua_newtable (L);
+      lua_pushnil (L);
+      while (lua_next (L, index) != 0)
+      {
+        if (lua_type (L, -2) == LUA_TSTRING && !isMetaMethodName (lua_tostring (L, -2)))
+        {
+          lua_pushvalue (L, -2);
+          lua_insert (L, -2);
+          lua_rawset (L, -4);
+        }
+        else
+        {
+          lua_pop (L, 1);
+        }
+      }
+      lua_pushvalue (L, -1);
+      lua_rawsetp (L, index, Detail::getMethodsKey ());
+      rawsetfield (L, index, "__index");
+    }
+    else
+    {
+      lua_pushnil (L);
+      lua_rawsetp (L, index, Detail::getMethodsKey ());
+      lua_pushcfunction (L, &ClassBase::indexMetaMethod);
+      rawsetfield (L, index, "__index");
+    }
+  }
+
+  //----------------------------------------------------------------------------
+  /**
+    Returns true if a member name is reserved for metamethods.
+
+    Metamethods such as __gc and __index belong to the metatable of one
+    class, and may be installed after a class is flattened, so they are
+    never copied into derived classes.
+  */
+  static bool isMetaMethodName (char const* name)
+  {
+    return name [0] == '_' && name [1] == '_';
+  }
+
+  //----------------------------------------------------------------------------
+  /**
+    Propagate a changed member to flattened derived classes.
+
+    A derived table receives the new value if it does not have the member,
+    or if it still holds the old value inherited from this table. This
+    continues down the hierarchy. Metamethods are not propagated.
+  */
+  static void propagateMember (lua_State* L, int index, void const* field,
+                               char const* name, int oldValue, int newValue)
+  {
+    if (field == 0 && isMetaMethodName (name))
+      return;
+
+    int const top = lua_gettop (L);
+    luaL_checkstack (L, 4, "class hierarchy too deep");
+
+    lua_rawgetp (L, index, Detail::getDerivedKey ());
+    if (lua_istable (L, -1))
+    {
+      int const derived = lua_gettop (L);
+      for (int i = 1;; ++i)
+      {
+        lua_rawgeti (L, derived, i);
+        if (lua_isnil (L, -1))
+          break;
+
+        int const child = lua_gettop (L);
+        if (field != 0)
+          lua_rawgetp (L, child, field);
+        else
+          lua_pushvalue (L, child);
+        assert (lua_istable (L, -1));
+
+        rawgetfield (L, -1, name);
+        if (lua_isnil (L, -1) || lua_rawequal (L, -1, oldValue))
+        {
+          lua_pop (L, 1);
+          lua_pushvalue (L, newValue);
+          rawsetfield (L, -2, name);
+          if (field != 0)
+            setIndexMode (L, child);
+          else
+            setMethod (L, child, name, newValue);
+          propagateMember (L, child, field, name, oldValue, newValue);
+        }
+        lua_settop (L, derived);
+      }
+    }
+
+    lua_settop (L, top);
+  }
+
+  //----------------------------------------------------------------------------
+  /**
+    Copy inherited members into a flattened derived class.
+
+    The cfunctions in the table at from (or in its sub-table under field)
+    are copied into the corresponding table at to, except for metamethods
+    and for the members which the derived table already has.
+  */
+  static void copyMembers (lua_State* L, int from, int to, void const* field)
+  {
+    from = lua_absindex (L, from);
+    to = lua_absindex (L, to);
+
+    if (field != 0)
+    {
+      lua_rawgetp (L, from, field);
+      lua_rawgetp (L, to, field);
+    }
+    else
+    {
+      lua_pushvalue (L, from);
+      lua_pushvalue (L, to);
+    }
+
+    if (lua_istable (L, -2) && lua_istable (L, -1))
+    {
+      lua_pushnil (L);
+      while (lua_next (L, -3) != 0)
+      {
+        if (lua_type (L, -2) == LUA_TSTRING && lua_iscfunction (L, -1) &&
+            (field != 0 || !isMetaMethodName (lua_tostring (L, -2))))
+        {
+          lua_pushvalue (L, -2);
+          lua_rawget (L, -4);
+          bool const isMissing = lua_isnil (L, -1);
+          lua_pop (L, 1);
+          if (isMissing)
+          {
+            lua_pushvalue (L, -2);
+            lua_pushvalue (L, -2);
+            lua_rawset (L, -5);
+          }
+        }
+        lua_pop (L, 1);
+      }
+    }
+
+    lua_pop (L, 2);
+  }
+
+  //----------------------------------------------------------------------------
+  /**
+    Flatten a derived class table or const table.
+
+    The inherited members of the base table at from are copied into the
+    derived table at to, and the derived table is remembered in the base
+    so that later registrations on the base propagate down.
+  */
+  static void flattenMembers (lua_State* L, int from, int to)
+  {
+    from = lua_absindex (L, from);
+    to = lua_absindex (L, to);
+
+    copyMembers (L, from, to, 0);
+    copyMembers (L, from, to, Detail::getPropgetKey ());
+    copyMembers (L, from, to, Detail::getPropsetKey ());
+
+    lua_rawgetp (L, from, Detail::getDerivedKey ());
+    if (lua_isnil (L, -1))
+    {
+      lua_pop (L, 1);
+      lua_newtable (L);
+      lua_pushvalue (L, -1);
+      lua_rawsetp (L, from, Detail::getDerivedKey ());
+    }
+    lua_pushvalue (L, to);
+    lua_rawseti (L, -2, static_cast <int> (lua_rawlen (L, -2)) + 1);
+    lua_pop (L, 1);
+  }
+
   //----------------------------------------------------------------------------
 
   // SFINAE Helpers
@@ -3622,8 +4863,17 @@ private:
       new (lua_newuserdata (L, sizeof (MemFn))) MemFn (mf);
       lua_pushcclosure (L, &CallMemberFunction <MemFn>::callConst, 1);
       lua_pushvalue (L, -1);
-      rawsetfield (L, -5, name); // const table
-      rawsetfield (L, -3, name); // class table
+      setMember (L, -5, 0, name); // const table
+      setMember (L, -3, 0, name); // class table
+    }
+
+    static void addUnchecked (lua_State* L, char const* name, MemFn mf)
+    {
+      new (lua_newuserdata (L, sizeof (MemFn))) MemFn (mf);
+      lua_pushcclosure (L, &CallMemberFunction <MemFn>::callUnchecked, 1);
+      lua_pushvalue (L, -1);
+      setMember (L, -5, 0, name); // const table
+      setMember (L, -3, 0, name); // class table
     }
   };
 
@@ -3634,7 +4884,14 @@ private:
     {
       new (lua_newuserdata (L, sizeof (MemFn))) MemFn (mf);
       lua_pushcclosure (L, &CallMemberFunction <MemFn>::call, 1);
-      rawsetfield (L, -3, name); // class table
+      setMember (L, -3, 0, name); // class table
+    }
+
+    static void addUnchecked (lua_State* L, char const* name, MemFn mf)
+    {
+      new (lua_newuserdata (L, sizeof (MemFn))) MemFn (mf);
+      lua_pushcclosure (L, &CallMemberFunction <MemFn>::callUnchecked, 1);
+      setMember (L, -3, 0, name); // class table
     }
   };
 
@@ -3713,7 +4970,7 @@ private:
           throw std::logic_error ("not a cfunction");
         }
 
-        rawgetfield (L, -1, "__propget");           // get __propget table
+        lua_rawgetp (L, -1, Detail::getPropgetKey ()); // get __propget table
         if (lua_istable (L, -1))                    // ensure it is a table
         {
           lua_pushvalue (L, 2);                     // push key arg2
@@ -3749,7 +5006,7 @@ private:
 
         // Repeat the lookup in the __parent metafield,
         // or return nil if the field doesn't exist.
-        rawgetfield (L, -1, "__parent");
+        lua_rawgetp (L, -1, Detail::getParentKey ());
         if (lua_istable (L, -1))
         {
           // Remove metatable and repeat the search in __parent.
@@ -3787,7 +5044,7 @@ private:
       for (;;)
       {
         // Check __propset
-        rawgetfield (L, -1, "__propset");
+        lua_rawgetp (L, -1, Detail::getPropsetKey ());
         if (!lua_isnil (L, -1))
         {
           lua_pushvalue (L, 2);
@@ -3807,7 +5064,7 @@ private:
         lua_pop (L, 1);
 
         // Repeat the lookup in the __parent metafield.
-        rawgetfield (L, -1, "__parent");
+        lua_rawgetp (L, -1, Detail::getParentKey ());
         if (lua_isnil (L, -1))
         {
           // Either the property or __parent must exist.
@@ -3820,25 +5077,46 @@ private:
       return result;
     }
 
+    //--------------------------------------------------------------------------
+    /**
+      Set the compiled Ancestry of a class table or const table.
+
+      If parentIndex is not zero, it refers to the corresponding table of
+      the base class, whose ancestry is appended. The flatten flag tells if
+      the inherited members are copied into the table.
+    */
+    void setAncestry (int index, void const* classKey, bool isConst,
+                      int parentIndex, bool flatten)
+    {
+      index = lua_absindex (L, index);
+      Detail::Ancestry const* const base =
+        parentIndex != 0 ? Detail::Ancestry::get (L, parentIndex) : 0;
+      bool const isFlat = base == 0 || (flatten && base->isFlat);
+      Detail::Ancestry const* const previous = Detail::Ancestry::get (L, index);
+      Detail::Ancestry* const ancestry =
+        Detail::Ancestry::push (L, classKey, isConst, isFlat, base);
+      ancestry->hasFinalizer = previous != 0 && previous->hasFinalizer;
+      lua_rawsetp (L, index, Detail::getIdentityKey ());
+    }
+
     //--------------------------------------------------------------------------
     /**
       Create the const table.
     */
-    void createConstTable (char const* name)
+    void createConstTable (char const* name, void const* classKey)
     {
       lua_newtable (L);
       lua_pushvalue (L, -1);
       lua_setmetatable (L, -2);
-      lua_pushboolean (L, 1);
-      lua_rawsetp (L, -2, Detail::getIdentityKey ());
+      setAncestry (-1, classKey, true, 0, false);
       lua_pushstring (L, (std::string ("const ") + name).c_str ());
-      rawsetfield (L, -2, "__type");
+      lua_rawsetp (L, -2, Detail::getTypeKey ());
       lua_pushcfunction (L, &indexMetaMethod);
       rawsetfield (L, -2, "__index");
       lua_pushcfunction (L, &newindexMetaMethod);
       rawsetfield (L, -2, "__newindex");
       lua_newtable (L);
-      rawsetfield (L, -2, "__propget");
+      lua_rawsetp (L, -2, Detail::getPropgetKey ());
       
       if (Detail::Security::hideMetatables ())
       {
@@ -3853,29 +5131,28 @@ private:
 
       The Lua stack should have the const table on top.
     */
-    void createClassTable (char const* name)
+    void createClassTable (char const* name, void const* classKey)
     {
       lua_newtable (L);
       lua_pushvalue (L, -1);
       lua_setmetatable (L, -2);
-      lua_pushboolean (L, 1);
-      lua_rawsetp (L, -2, Detail::getIdentityKey ());
+      setAncestry (-1, classKey, false, 0, false);
       lua_pushstring (L, name);
-      rawsetfield (L, -2, "__type");
+      lua_rawsetp (L, -2, Detail::getTypeKey ());
       lua_pushcfunction (L, &indexMetaMethod);
       rawsetfield (L, -2, "__index");
       lua_pushcfunction (L, &newindexMetaMethod);
       rawsetfield (L, -2, "__newindex");
       lua_newtable (L);
-      rawsetfield (L, -2, "__propget");
+      lua_rawsetp (L, -2, Detail::getPropgetKey ());
       lua_newtable (L);
-      rawsetfield (L, -2, "__propset");
+      lua_rawsetp (L, -2, Detail::getPropsetKey ());
 
       lua_pushvalue (L, -2);
-      rawsetfield (L, -2, "__const"); // point to const table
+      lua_rawsetp (L, -2, Detail::getConstTableKey ()); // point to const table
 
       lua_pushvalue (L, -1);
-      rawsetfield (L, -3, "__class"); // point const table to class table
+      lua_rawsetp (L, -3, Detail::getClassTableKey ()); // point const table to class table
 
       if (Detail::Security::hideMetatables ())
       {
@@ -3912,12 +5189,12 @@ private:
       lua_pushcfunction (L, &Namespace::newindexMetaMethod);
       rawsetfield (L, -2, "__newindex");
       lua_newtable (L);
-      rawsetfield (L, -2, "__propget");
+      lua_rawsetp (L, -2, Detail::getPropgetKey ());
       lua_newtable (L);
-      rawsetfield (L, -2, "__propset");
+      lua_rawsetp (L, -2, Detail::getPropsetKey ());
 
       lua_pushvalue (L, -2);
-      rawsetfield (L, -2, "__class"); // point to class table
+      lua_rawsetp (L, -2, Detail::getClassTableKey ()); // point to class table
 
       if (Detail::Security::hideMetatables ())
       {
@@ -4015,13 +5292,19 @@ private:
   private:
     //--------------------------------------------------------------------------
     /**
-      __gc metamethod for a class.
+      Install __gc in the const table and class table on top of the stack, if
+      objects of T stored by value need to be destroyed.
+
+      Objects referenced by pointer never need a finalizer, and containers
+      install it when the first one is pushed.
     */
-    static int gcMetaMethod (lua_State* L)
+    static void setValueFinalizer (lua_State* L)
     {
-      Detail::Userdata* ud = Detail::Userdata::getExact <T> (L, 1);
-      ud->~Userdata ();
-      return 0;
+      if (!Detail::TypeTraits::isTriviallyDestructible <T>::value)
+      {
+        Detail::Userdata::setFinalizer <T> (L, -2);
+        Detail::Userdata::setFinalizer <T> (L, -1);
+      }
     }
 
     //--------------------------------------------------------------------------
@@ -4070,13 +5353,9 @@ private:
       {
         lua_pop (L, 1);
 
-        createConstTable (name);
-        lua_pushcfunction (L, &gcMetaMethod);
-        rawsetfield (L, -2, "__gc");
-
-        createClassTable (name);
-        lua_pushcfunction (L, &gcMetaMethod);
-        rawsetfield (L, -2, "__gc");
+        createConstTable (name, Detail::ClassInfo <T>::getClassKey ());
+        createClassTable (name, Detail::ClassInfo <T>::getClassKey ());
+        setValueFinalizer (L);
 
         createStaticTable (name);
 
@@ -4087,11 +5366,17 @@ private:
         lua_rawsetp (L, LUA_REGISTRYINDEX, Detail::ClassInfo <T>::getClassKey ());
         lua_pushvalue (L, -3);
         lua_rawsetp (L, LUA_REGISTRYINDEX, Detail::ClassInfo <T>::getConstKey ());
+
+        setIndexMode (L, -3);
+        setIndexMode (L, -2);
       }
       else
       {
-        rawgetfield (L, -1, "__class");
-        rawgetfield (L, -1, "__const");
+        // The class and const tables are in the static table's metatable.
+        lua_getmetatable (L, -1);
+        lua_remove (L, -2);
+        lua_rawgetp (L, -1, Detail::getClassTableKey ());
+        lua_rawgetp (L, -1, Detail::getConstTableKey ());
 
         // Reverse the top 3 stack elements
         lua_insert (L, -3);
@@ -4102,8 +5387,11 @@ private:
     //==========================================================================
     /**
       Derive a new class.
+
+      If flatten is true, the inherited members are copied into the class.
     */
-    Class (char const* name, Namespace const* parent, void const* const staticKey)
+    Class (char const* name, Namespace const* parent, void const* const staticKey,
+           bool flatten)
       : ClassBase (parent->L)
     {
       m_stackSize = parent->m_stackSize + 3;
@@ -4111,26 +5399,31 @@ private:
 
       assert (lua_istable (L, -1));
 
-      createConstTable (name);
-      lua_pushcfunction (L, &gcMetaMethod);
-      rawsetfield (L, -2, "__gc");
-
-      createClassTable (name);
-      lua_pushcfunction (L, &gcMetaMethod);
-      rawsetfield (L, -2, "__gc");
+      createConstTable (name, Detail::ClassInfo <T>::getClassKey ());
+      createClassTable (name, Detail::ClassInfo <T>::getClassKey ());
+      setValueFinalizer (L);
 
       createStaticTable (name);
 
       lua_rawgetp (L, LUA_REGISTRYINDEX, staticKey);
       assert (lua_istable (L, -1));
-      rawgetfield (L, -1, "__class");
+      lua_rawgetp (L, -1, Detail::getClassTableKey ());
       assert (lua_istable (L, -1));
-      rawgetfield (L, -1, "__const");
+      lua_rawgetp (L, -1, Detail::getConstTableKey ());
       assert (lua_istable (L, -1));
 
-      rawsetfield (L, -6, "__parent");
-      rawsetfield (L, -4, "__parent");
-      rawsetfield (L, -2, "__parent");
+      setAncestry (-6, Detail::ClassInfo <T>::getClassKey (), true, -1, flatten);
+      setAncestry (-5, Detail::ClassInfo <T>::getClassKey (), false, -2, flatten);
+
+      if (flatten)
+      {
+        flattenMembers (L, -1, -6);
+        flattenMembers (L, -2, -5);
+      }
+
+      lua_rawsetp (L, -6, Detail::getParentKey ());
+      lua_rawsetp (L, -4, Detail::getParentKey ());
+      lua_rawsetp (L, -2, Detail::getParentKey ());
 
       lua_pushvalue (L, -1);
       lua_rawsetp (L, LUA_REGISTRYINDEX, Detail::ClassInfo <T>::getStaticKey ());
@@ -4138,6 +5431,9 @@ private:
       lua_rawsetp (L, LUA_REGISTRYINDEX, Detail::ClassInfo <T>::getClassKey ());
       lua_pushvalue (L, -3);
       lua_rawsetp (L, LUA_REGISTRYINDEX, Detail::ClassInfo <T>::getConstKey ());
+
+      setIndexMode (L, -3);
+      setIndexMode (L, -2);
     }
 
     //--------------------------------------------------------------------------
@@ -4158,14 +5454,14 @@ private:
     {
       assert (lua_istable (L, -1));
 
-      rawgetfield (L, -1, "__propget");
+      lua_rawgetp (L, -1, Detail::getPropgetKey ());
       assert (lua_istable (L, -1));
       lua_pushlightuserdata (L, pu);
       lua_pushcclosure (L, &getVariable <U>, 1);
       rawsetfield (L, -2, name);
       lua_pop (L, 1);
 
-      rawgetfield (L, -1, "__propset");
+      lua_rawgetp (L, -1, Detail::getPropsetKey ());
       assert (lua_istable (L, -1));
       if (isWritable)
       {
@@ -4197,14 +5493,14 @@ private:
       
       assert (lua_istable (L, -1));
 
-      rawgetfield (L, -1, "__propget");
+      lua_rawgetp (L, -1, Detail::getPropgetKey ());
       assert (lua_istable (L, -1));
       new (lua_newuserdata (L, sizeof (get))) get_t (get);
       lua_pushcclosure (L, &CallFunction <U (*) (void)>::call, 1);
       rawsetfield (L, -2, name);
       lua_pop (L, 1);
 
-      rawgetfield (L, -1, "__propset");
+      lua_rawgetp (L, -1, Detail::getPropsetKey ());
       assert (lua_istable (L, -1));
       if (set != 0)
       {
@@ -4258,25 +5554,19 @@ private:
 
       // Add to __propget in class and const tables.
       {
-        rawgetfield (L, -2, "__propget");
-        rawgetfield (L, -4, "__propget");
         new (lua_newuserdata (L, sizeof (mp_t))) mp_t (mp);
         lua_pushcclosure (L, &getProperty <U>, 1);
         lua_pushvalue (L, -1);
-        rawsetfield (L, -4, name);
-        rawsetfield (L, -2, name);
-        lua_pop (L, 2);
+        setMember (L, -5, Detail::getPropgetKey (), name);
+        setMember (L, -3, Detail::getPropgetKey (), name);
       }
 
       if (isWritable)
       {
         // Add to __propset in class table.
-        rawgetfield (L, -2, "__propset");
-        assert (lua_istable (L, -1));
         new (lua_newuserdata (L, sizeof (mp_t))) mp_t (mp);
         lua_pushcclosure (L, &setProperty <U>, 1);
-        rawsetfield (L, -2, name);
-        lua_pop (L, 1);
+        setMember (L, -3, Detail::getPropsetKey (), name);
       }
 
       return *this;
@@ -4291,26 +5581,20 @@ private:
     {
       // Add to __propget in class and const tables.
       {
-        rawgetfield (L, -2, "__propget");
-        rawgetfield (L, -4, "__propget");
         typedef TG (T::*get_t) () const;
         new (lua_newuserdata (L, sizeof (get_t))) get_t (get);
         lua_pushcclosure (L, &CallMemberFunction <get_t>::callConst, 1);
         lua_pushvalue (L, -1);
-        rawsetfield (L, -4, name);
-        rawsetfield (L, -2, name);
-        lua_pop (L, 2);
+        setMember (L, -5, Detail::getPropgetKey (), name);
+        setMember (L, -3, Detail::getPropgetKey (), name);
       }
 
       {
         // Add to __propset in class table.
-        rawgetfield (L, -2, "__propset");
-        assert (lua_istable (L, -1));
         typedef void (T::* set_t) (TS);
         new (lua_newuserdata (L, sizeof (set_t))) set_t (set);
         lua_pushcclosure (L, &CallMemberFunction <set_t>::call, 1);
-        rawsetfield (L, -2, name);
-        lua_pop (L, 1);
+        setMember (L, -3, Detail::getPropsetKey (), name);
       }
 
       return *this;
@@ -4321,15 +5605,12 @@ private:
     Class <T>& addProperty (char const* name, TG (T::* get) () const)
     {
       // Add to __propget in class and const tables.
-      rawgetfield (L, -2, "__propget");
-      rawgetfield (L, -4, "__propget");
       typedef TG (T::*get_t) () const;
       new (lua_newuserdata (L, sizeof (get_t))) get_t (get);
       lua_pushcclosure (L, &CallMemberFunction <get_t>::callConst, 1);
       lua_pushvalue (L, -1);
-      rawsetfield (L, -4, name);
-      rawsetfield (L, -2, name);
-      lua_pop (L, 2);
+      setMember (L, -5, Detail::getPropgetKey (), name);
+      setMember (L, -3, Detail::getPropgetKey (), name);
 
       return *this;
     }
@@ -4350,27 +5631,21 @@ private:
     {
       // Add to __propget in class and const tables.
       {
-        rawgetfield (L, -2, "__propget");
-        rawgetfield (L, -4, "__propget");
         typedef TG (*get_t) (T const*);
         new (lua_newuserdata (L, sizeof (get_t))) get_t (get);
         lua_pushcclosure (L, &CallFunction <get_t>::call, 1);
         lua_pushvalue (L, -1);
-        rawsetfield (L, -4, name);
-        rawsetfield (L, -2, name);
-        lua_pop (L, 2);
+        setMember (L, -5, Detail::getPropgetKey (), name);
+        setMember (L, -3, Detail::getPropgetKey (), name);
       }
 
       if (set != 0)
       {
         // Add to __propset in class table.
-        rawgetfield (L, -2, "__propset");
-        assert (lua_istable (L, -1));
         typedef void (*set_t) (T*, TS);
         new (lua_newuserdata (L, sizeof (set_t))) set_t (set);
         lua_pushcclosure (L, &CallFunction <set_t>::call, 1);
-        rawsetfield (L, -2, name);
-        lua_pop (L, 1);
+        setMember (L, -3, Detail::getPropsetKey (), name);
       }
 
       return *this;
@@ -4381,15 +5656,12 @@ private:
     Class <T>& addProperty (char const* name, TG (*get) (T const*))
     {
       // Add to __propget in class and const tables.
-      rawgetfield (L, -2, "__propget");
-      rawgetfield (L, -4, "__propget");
       typedef TG (*get_t) (T const*);
       new (lua_newuserdata (L, sizeof (get_t))) get_t (get);
       lua_pushcclosure (L, &CallFunction <get_t>::call, 1);
       lua_pushvalue (L, -1);
-      rawsetfield (L, -4, name);
-      rawsetfield (L, -2, name);
-      lua_pop (L, 2);
+      setMember (L, -5, Detail::getPropgetKey (), name);
+      setMember (L, -3, Detail::getPropgetKey (), name);
 
       return *this;
     }
@@ -4405,6 +5677,17 @@ private:
       return *this;
     }
 
+    //--------------------------------------------------------------------------
+    /**
+      Add or replace a member function which does not check its arguments.
+    */
+    template <class MemFn>
+    Class <T>& addFunction (char const* name, MemFn mf, Unchecked)
+    {
+      CallMemberFunctionHelper <MemFn, FuncTraits <MemFn>::isConstMemberFunction>::addUnchecked (L, name, mf);
+      return *this;
+    }
+
     //--------------------------------------------------------------------------
     /**
       Add or replace a member lua_CFunction.
@@ -4415,7 +5698,7 @@ private:
       assert (lua_istable (L, -1));
       new (lua_newuserdata (L, sizeof (mfp))) MFP (mfp);
       lua_pushcclosure (L, &CallMemberCFunction <T>::call, 1);
-      rawsetfield (L, -3, name); // class table
+      setMember (L, -3, 0, name); // class table
 
       return *this;
     }
@@ -4431,8 +5714,8 @@ private:
       new (lua_newuserdata (L, sizeof (mfp))) MFP (mfp);
       lua_pushcclosure (L, &CallMemberCFunction <T>::callConst, 1);
       lua_pushvalue (L, -1);
-      rawsetfield (L, -5, name); // const table
-      rawsetfield (L, -3, name); // class table
+      setMember (L, -5, 0, name); // const table
+      setMember (L, -3, 0, name); // class table
 
       return *this;
     }
@@ -4516,9 +5799,9 @@ private:
       lua_pushcfunction (L, &newindexMetaMethod);
       rawsetfield (L, -2, "__newindex");
       lua_newtable (L);
-      rawsetfield (L, -2, "__propget");
+      lua_rawsetp (L, -2, Detail::getPropgetKey ());
       lua_newtable (L);
-      rawsetfield (L, -2, "__propset");
+      lua_rawsetp (L, -2, Detail::getPropsetKey ());
       lua_pushvalue (L, -1);
       rawsetfield (L, -3, name);
 #if 0
@@ -4621,14 +5904,14 @@ public:
   {
     assert (lua_istable (L, -1));
 
-    rawgetfield (L, -1, "__propget");
+    lua_rawgetp (L, -1, Detail::getPropgetKey ());
     assert (lua_istable (L, -1));
     lua_pushlightuserdata (L, pt);
     lua_pushcclosure (L, &getVariable <T>, 1);
     rawsetfield (L, -2, name);
     lua_pop (L, 1);
 
-    rawgetfield (L, -1, "__propset");
+    lua_rawgetp (L, -1, Detail::getPropsetKey ());
     assert (lua_istable (L, -1));
     if (isWritable)
     {
@@ -4657,14 +5940,14 @@ public:
   {
     assert (lua_istable (L, -1));
 
-    rawgetfield (L, -1, "__propget");
+    lua_rawgetp (L, -1, Detail::getPropgetKey ());
     assert (lua_istable (L, -1));
     lua_pushlightuserdata (L, get);
     lua_pushcclosure (L, &CallFunction <TG (*) (void)>::call, 1);
     rawsetfield (L, -2, name);
     lua_pop (L, 1);
 
-    rawgetfield (L, -1, "__propset");
+    lua_rawgetp (L, -1, Detail::getPropsetKey ());
     assert (lua_istable (L, -1));
     if (set != 0)
     {
@@ -4698,6 +5981,22 @@ public:
     return *this;
   }
 
+  //----------------------------------------------------------------------------
+  /**
+    Add or replace a function which does not check its arguments.
+  */
+  template <class FP>
+  Namespace& addFunction (char const* name, FP const fp, Unchecked)
+  {
+    assert (lua_istable (L, -1));
+
+    new (lua_newuserdata (L, sizeof (fp))) FP (fp);
+    lua_pushcclosure (L, &CallFunction <FP>::callUnchecked, 1);
+    rawsetfield (L, -2, name);
+
+    return *this;
+  }
+
   //----------------------------------------------------------------------------
   /**
     Add or replace a lua_CFunction.
@@ -4726,11 +6025,16 @@ public:
 
     To continue registrations for the class later, use beginClass().
     Do not call deriveClass() again.
+
+    If flatten is true, the member functions, data members and properties
+    inherited from U are copied into the class, so that looking them up does
+    not walk the chain of base classes. Members added to U later are copied
+    as well, unless the derived class overrides them.
   */
   template <class T, class U>
-  Class <T> deriveClass (char const* name)
+  Class <T> deriveClass (char const* name, bool flatten = false)
   {
-    return Class <T> (name, this, Detail::ClassInfo <U>::getStaticKey ());
+    return Class <T> (name, this, Detail::ClassInfo <U>::getStaticKey (), flatten);
   }
 };
 
@@ -4777,6 +6081,16 @@ inline void setHideMetatables (bool shouldHide)
   Detail::Security::setHideMetatables (shouldHide);
 }
 
+//------------------------------------------------------------------------------
+/**
+  Change whether or not a lua_State reuses the userdata of objects pushed by
+  pointer or by container (off by default).
+*/
+inline void setIdentityCache (lua_State* L, bool enable)
+{
+  Detail::IdentityCache::setEnabled (L, enable);
+}
+
 }
 
 //==============================================================================
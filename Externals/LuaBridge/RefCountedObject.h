@@ -44,7 +44,85 @@
 #error LuaBridge.h must be included before including this file
 #endif
 
-//#define LUABRIDGE_COMPILER_SUPPORTS_MOVE_SEMANTICS 1
+#if __cplusplus >= 201103L || (defined (_MSC_VER) && _MSC_VER >= 1700)
+# include <atomic>
+# define LUABRIDGE_HAS_STD_ATOMIC 1
+#elif defined (_MSC_VER)
+# include <intrin.h>
+#endif
+
+//==============================================================================
+/**
+  A reference count which may be changed from several threads at once.
+
+  Use this as the CounterType of RefCountedObjectType for objects which are
+  shared between threads, for example between lua_State objects running on
+  different threads. Increments are relaxed, since taking a new reference
+  requires already holding one. Decrements are acquire-release, so that the
+  thread which deletes the object sees all the writes of the others.
+
+  Where std::atomic is not available, the compiler's interlocked operations
+  are used instead. These are full barriers.
+*/
+class AtomicCounter
+{
+public:
+  AtomicCounter () : m_value (0)
+  {
+  }
+
+  /** Copying an object does not copy its references. */
+  AtomicCounter (AtomicCounter const&) : m_value (0)
+  {
+  }
+
+  AtomicCounter& operator= (AtomicCounter const&)
+  {
+    return *this;
+  }
+
+  /** Increment the count, and return the new count. */
+  int operator++ ()
+  {
+#if LUABRIDGE_HAS_STD_ATOMIC
+    return m_value.fetch_add (1, std::memory_order_relaxed) + 1;
+#elif defined (_MSC_VER)
+    return int (_InterlockedIncrement (&m_value));
+#else
+    return __sync_add_and_fetch (&m_value, 1);
+#endif
+  }
+
+  /** Decrement the count, and return the new count. */
+  int operator-- ()
+  {
+#if LUABRIDGE_HAS_STD_ATOMIC
+    return m_value.fetch_sub (1, std::memory_order_acq_rel) - 1;
+#elif defined (_MSC_VER)
+    return int (_InterlockedDecrement (&m_value));
+#else
+    return __sync_sub_and_fetch (&m_value, 1);
+#endif
+  }
+
+  operator int () const
+  {
+#if LUABRIDGE_HAS_STD_ATOMIC
+    return m_value.load (std::memory_order_relaxed);
+#else
+    return int (m_value);
+#endif
+  }
+
+private:
+#if LUABRIDGE_HAS_STD_ATOMIC
+  std::atomic <int> m_value;
+#elif defined (_MSC_VER)
+  long volatile m_value;
+#else
+  int volatile m_value;
+#endif
+};
 
 //==============================================================================
 /**
@@ -53,8 +131,13 @@
   To add reference-counting to a class, derive it from this class, and
   use the RefCountedObjectPtr class to point to it.
 
+  The CounterType selects how the count is changed. A plain integer, as in
+  RefCountedObject, is fastest but only safe when all references to the
+  object are taken and released on one thread at a time. AtomicCounter, as
+  in AtomicRefCountedObject, allows references on several threads.
+
   e.g. @code
-  class MyClass : public RefCountedObjectType
+  class MyClass : public RefCountedObject
   {
       void foo();
 
@@ -112,6 +195,17 @@ protected:
   {
   }
 
+  /** Creates a copy of an object, which starts without references. */
+  RefCountedObjectType (RefCountedObjectType const&) : refCount ()
+  {
+  }
+
+  /** Assigning an object leaves its references alone. */
+  RefCountedObjectType& operator= (RefCountedObjectType const&)
+  {
+    return *this;
+  }
+
   /** Destructor. */
   virtual ~RefCountedObjectType()
   {
@@ -124,6 +218,12 @@ private:
   CounterType mutable refCount;
 };
 
+/** A reference counted object for use on one thread at a time. */
+typedef RefCountedObjectType <int> RefCountedObject;
+
+/** A reference counted object which may be shared between threads. */
+typedef RefCountedObjectType <AtomicCounter> AtomicRefCountedObject;
+
 //==============================================================================
 /**
   A smart-pointer class which points to a reference-counted object.
@@ -31,40 +31,243 @@
 #ifndef LUABRIDGE_REFCOUNTEDPTR_HEADER
 #define LUABRIDGE_REFCOUNTEDPTR_HEADER
 
-#ifdef _MSC_VER
-# include <hash_map>
-#else
+#include <cassert>
+#include <cstddef>
+
+#ifndef _MSC_VER
 # include <stdint.h>
-# include <ext/hash_map>
 #endif
 
+template <class CounterType>
+class RefCountedObjectType;
+
 //==============================================================================
 /**
   Support for our RefCountedPtr.
 */
 struct RefCountedPtrBase
 {
-  // Declaration of container for the refcounts
-#ifdef _MSC_VER
-  typedef stdext::hash_map <const void *, int> RefCountsType;
-#else
-  struct ptr_hash
+  //============================================================================
+  /**
+    Hash table from object pointers to reference counts.
+
+    This uses open addressing with linear probing, which keeps each lookup
+    within a few adjacent slots. An entry is erased when its count reaches
+    zero, and the table shrinks again when it becomes sparse, so its size
+    is the number of objects currently referenced.
+  */
+  class RefCountTable
   {
-    size_t operator () (const void * const v) const
+  public:
+    RefCountTable () : m_entries (0), m_capacity (0), m_size (0)
+    {
+    }
+
+    ~RefCountTable ()
+    {
+      delete [] m_entries;
+    }
+
+    /** Returns the number of objects in the table. */
+    size_t size () const
+    {
+      return m_size;
+    }
+
+    /** Returns the number of slots in the table. */
+    size_t capacity () const
+    {
+      return m_capacity;
+    }
+
+    /** Increment the count of an object, and return the new count. */
+    int increment (void const* key)
+    {
+      assert (key != 0);
+
+      if ((m_size + 1) * 4 > m_capacity * 3)
+        resize (m_capacity == 0 ? size_t (minCapacity) : m_capacity * 2);
+
+      Entry& e = m_entries [find (key)];
+      if (e.key == 0)
+      {
+        e.key = key;
+        e.count = 0;
+        ++m_size;
+      }
+      return ++e.count;
+    }
+
+    /** Decrement the count of an object, and return the new count.
+
+        The object is removed from the table when its count reaches zero.
+    */
+    int decrement (void const* key)
+    {
+      if (m_size == 0)
+        return 0;
+
+      size_t const i = find (key);
+      if (m_entries [i].key == 0)
+        return 0;
+
+      int const count = --m_entries [i].count;
+      if (count <= 0)
+      {
+        erase (i);
+
+        if (m_capacity > minCapacity && m_size * 8 < m_capacity)
+          resize (m_capacity / 2);
+      }
+      return count;
+    }
+
+    /** Returns the count of an object, or zero if it is not in the table. */
+    int count (void const* key) const
+    {
+      if (m_size == 0)
+        return 0;
+
+      Entry const& e = m_entries [find (key)];
+      return e.key != 0 ? e.count : 0;
+    }
+
+  private:
+    struct Entry
+    {
+      void const* key;
+      int count;
+    };
+
+    enum
+    {
+      minCapacity = 16
+    };
+
+    RefCountTable (RefCountTable const&);
+    RefCountTable& operator= (RefCountTable const&);
+
+    /** Returns the home slot of a key.
+
+        Objects are aligned, so the low bits of a pointer say little. The
+        bits are mixed so that the slot depends on all of them.
+    */
+    size_t hash (void const* key) const
+    {
+      uintptr_t h = reinterpret_cast <uintptr_t> (key);
+      h ^= h >> 17;
+      h *= uintptr_t (0x9e3779b1u);
+      h ^= h >> 15;
+      return size_t (h) & (m_capacity - 1);
+    }
+
+    /** Returns the slot of a key, or the empty slot where it belongs. */
+    size_t find (void const* key) const
+    {
+      size_t const mask = m_capacity - 1;
+      size_t i = hash (key);
+      while (m_entries [i].key != 0 && m_entries [i].key != key)
+        i = (i + 1) & mask;
+      return i;
+    }
+
+    /** Empty a slot, moving back the entries which probed past it. */
+    void erase (size_t i)
     {
-      static __gnu_cxx::hash<unsigned int> H;
-      return H(uintptr_t(v));
+      size_t const mask = m_capacity - 1;
+      size_t j = i;
+      for (;;)
+      {
+        j = (j + 1) & mask;
+        if (m_entries [j].key == 0)
+          break;
+
+        // The entry at j may move to i unless its home slot is in (i, j].
+        size_t const k = hash (m_entries [j].key);
+        if (i <= j ? (i < k && k <= j) : (i < k || k <= j))
+          continue;
+
+        m_entries [i] = m_entries [j];
+        i = j;
+      }
+
+      m_entries [i].key = 0;
+      m_entries [i].count = 0;
+      --m_size;
     }
+
+    void resize (size_t capacity)
+    {
+      Entry* const old = m_entries;
+      size_t const oldCapacity = m_capacity;
+
+      m_entries = new Entry [capacity] ();
+      m_capacity = capacity;
+
+      for (size_t i = 0; i < oldCapacity; ++i)
+      {
+        if (old [i].key != 0)
+          m_entries [find (old [i].key)] = old [i];
+      }
+
+      delete [] old;
+    }
+
+    Entry* m_entries;
+    size_t m_capacity;
+    size_t m_size;
   };
-  typedef __gnu_cxx::hash_map<const void *, int, ptr_hash> RefCountsType;
-#endif
+
+  typedef RefCountTable RefCountsType;
+
+  /** Returns the number of objects in the reference count table.
+
+      Objects whose class keeps its own count are not in the table.
+  */
+  static size_t getRefCountTableSize ()
+  {
+    return getRefCounts ().size ();
+  }
+
+  /** Returns the number of slots in the reference count table.
+
+      The load of the table is its size divided by its capacity.
+  */
+  static size_t getRefCountTableCapacity ()
+  {
+    return getRefCounts ().capacity ();
+  }
 
 protected:
-  inline RefCountsType& getRefCounts ()
+  static RefCountsType& getRefCounts ()
   {
     static RefCountsType refcounts;
     return refcounts ;
   }
+
+  template <bool>
+  struct Bool
+  {
+  };
+
+  /** Determine if T keeps its own reference count.
+
+      This is true for classes derived from RefCountedObjectType.
+  */
+  template <class T>
+  struct IsIntrusive
+  {
+  private:
+    typedef char yes [1];
+    typedef char no [2];
+
+    template <class CounterType>
+    static yes& test (RefCountedObjectType <CounterType> const*);
+    static no& test (...);
+
+  public:
+    static const bool value = sizeof (test (static_cast <T*> (0))) == sizeof (yes);
+  };
 };
 
 //==============================================================================
@@ -75,16 +278,22 @@ protected:
   sense that it implements a strict subset of the functionality.
 
   This implementation uses a hash table to look up the reference count
-  associated with a particular pointer.
+  associated with a particular pointer. Null pointers are not counted. The
+  table is shared by the whole process and is not synchronized, so
+  RefCountedPtr objects must not be created, copied or destroyed on more
+  than one thread at a time, even when each thread uses its own lua_State.
+
+  If T is derived from RefCountedObjectType, the reference count is kept in
+  the object instead, and copying the pointer is a single increment. With
+  AtomicRefCountedObject, such pointers may also be used on several threads
+  at once. A RefCountedPtr can still be made from a raw pointer at any time,
+  which is how LuaBridge passes objects from Lua back to C++. In a class
+  hierarchy, the root class must derive from RefCountedObjectType.
 
   @tparam T The class type.
 
-  @todo Decompose RefCountedPtr using a policy. At a minimum, the underlying
-        reference count should be policy based (to support atomic operations)
-        and the delete behavior should be policy based (to support custom
-        disposal methods).
-
-  @todo Provide an intrusive version of RefCountedPtr.
+  @todo Make the delete behavior policy based, to support custom disposal
+        methods.
 */
 template <class T>
 class RefCountedPtr : private RefCountedPtrBase
@@ -102,7 +311,7 @@ public:
   */
   RefCountedPtr (T* p = 0) : m_p (p)
   {
-    ++getRefCounts () [m_p];
+    addReference (m_p);
   }
 
   /** Construct from another RefCountedPtr.
@@ -111,7 +320,7 @@ public:
   */
   RefCountedPtr (RefCountedPtr <T> const& rhs) : m_p (rhs.get())
   {
-    ++getRefCounts () [m_p];
+    addReference (m_p);
   }
 
   /** Construct from a RefCountedPtr of a different type.
@@ -124,9 +333,22 @@ public:
   template <typename U>
   RefCountedPtr (RefCountedPtr <U> const& rhs) : m_p (static_cast <T*> (rhs.get()))
   {
-    ++getRefCounts () [m_p];
+    addReference (m_p);
   }
 
+#if LUABRIDGE_COMPILER_SUPPORTS_MOVE_SEMANTICS
+  /** Take over the object from another RefCountedPtr.
+
+      The reference count is not changed, and rhs is left null.
+
+      @param rhs The RefCountedPtr to move from.
+  */
+  RefCountedPtr (RefCountedPtr <T>&& rhs) : m_p (rhs.m_p)
+  {
+    rhs.m_p = 0;
+  }
+#endif
+
   /** Release the object.
 
       If there are no more references then the object is deleted.
@@ -147,7 +369,7 @@ public:
     {
       reset ();
       m_p = rhs.m_p;
-      ++getRefCounts () [m_p];
+      addReference (m_p);
     }
     return *this;
   }
@@ -165,9 +387,27 @@ public:
   {
     reset ();
     m_p = static_cast <T*> (rhs.get());
-    ++getRefCounts () [m_p];
+    addReference (m_p);
+    return *this;
+  }
+
+#if LUABRIDGE_COMPILER_SUPPORTS_MOVE_SEMANTICS
+  /** Take over the object from another RefCountedPtr.
+
+      @param  rhs The RefCountedPtr to move from, which is left null.
+      @return     A reference to the RefCountedPtr.
+  */
+  RefCountedPtr <T>& operator= (RefCountedPtr <T>&& rhs)
+  {
+    if (this != &rhs)
+    {
+      reset ();
+      m_p = rhs.m_p;
+      rhs.m_p = 0;
+    }
     return *this;
   }
+#endif
 
   /** Retrieve the raw pointer.
 
@@ -204,7 +444,7 @@ public:
   */
   long use_count () const
   {
-    return getRefCounts () [m_p];
+    return getReferenceCount (m_p, Bool <IsIntrusive <T>::value> ());
   }
 
   /** Release the pointer.
@@ -216,14 +456,51 @@ public:
   {
     if (m_p != 0)
     {
-      if (--getRefCounts () [m_p] <= 0)
-        delete m_p;
+      releaseReference (m_p, Bool <IsIntrusive <T>::value> ());
 
       m_p = 0;
     }
   }
 
 private:
+  static void addReference (T* p)
+  {
+    addReference (p, Bool <IsIntrusive <T>::value> ());
+  }
+
+  static void addReference (T* p, Bool <true>)
+  {
+    if (p != 0)
+      p->incReferenceCount ();
+  }
+
+  static void addReference (T* p, Bool <false>)
+  {
+    if (p != 0)
+      getRefCounts ().increment (p);
+  }
+
+  static void releaseReference (T* p, Bool <true>)
+  {
+    p->decReferenceCount ();
+  }
+
+  static void releaseReference (T* p, Bool <false>)
+  {
+    if (getRefCounts ().decrement (p) <= 0)
+      delete p;
+  }
+
+  static long getReferenceCount (T* p, Bool <true>)
+  {
+    return p != 0 ? p->getReferenceCount () : 0;
+  }
+
+  static long getReferenceCount (T* p, Bool <false>)
+  {
+    return p != 0 ? getRefCounts ().count (p) : 0;
+  }
+
   T* m_p;
 };
 
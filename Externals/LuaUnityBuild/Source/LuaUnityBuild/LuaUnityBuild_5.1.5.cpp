@@ -40,6 +40,12 @@
 #endif
 #endif
 
+/* ldebug.h defines a getline macro, which breaks the getline declared by a
+   POSIX <stdio.h> if that is included after it. Include it first, so that
+   the includes in the Lua sources do nothing.
+*/
+#include <stdio.h>
+
 #ifdef __cplusplus
 extern "C"
 {
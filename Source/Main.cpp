@@ -40,6 +40,7 @@
 #include "LuaUnityBuild/LuaUnityBuild.h"
 
 #include "LuaBridge/LuaBridge.h"
+#include "LuaBridge/RefCountedObject.h"
 #include "LuaBridge/RefCountedPtr.h"
 
 #include "BinaryData.h"
@@ -50,7 +51,7 @@
 
 using namespace std;
 
-int main (int, char **)
+int main (int argc, char** argv)
 {
   lua_State* L = luaL_newstate ();
 
@@ -76,8 +77,8 @@ int main (int, char **)
     return 1;
   }
 
-  runSpeedTests ();
+  int const regressions = runSpeedTests (argc, argv);
 
   lua_close(L);
-  return 0;
+  return regressions > 0 ? 1 : 0;
 }
@@ -31,16 +31,50 @@
   Command line version of LuaBridge test suite.
 */
 
+#include <algorithm>
 #include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <cstring>
+#include <fstream>
 #include <iostream>
 #include <iomanip>
+#include <new>
+#include <sstream>
 #include <string>
 #include <vector>
-#include <ctime>
+
+#if defined (_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#include <intrin.h>
+#elif defined (__APPLE__)
+#include <mach/mach_time.h>
+#else
+#include <time.h>
+#endif
+
+#if !defined (_WIN32)
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+#if defined (__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+
+#if !defined (_WIN32) && (defined (__i386__) || defined (__x86_64__))
+#include <x86intrin.h>
+#endif
 
 #include "LuaUnityBuild/LuaUnityBuild.h"
 
 #include "LuaBridge/LuaBridge.h"
+#include "LuaBridge/RefCountedObject.h"
 #include "LuaBridge/RefCountedPtr.h"
 
 #include "BinaryData.h"
@@ -54,12 +88,17 @@ using namespace luabridge;
 
 //------------------------------------------------------------------------------
 /**
-  Simple stopwatch for measuring elapsed time.
+  Stopwatch for measuring elapsed wall clock time.
+
+  The time comes from a monotonic clock with nanosecond resolution where the
+  platform has one. On x86, the time stamp counter is read as well, which
+  gives the elapsed reference cycles.
 */
 class Stopwatch
 {
 private:
-  clock_t m_start;
+  double m_start;
+  unsigned long long m_startCycles;
 
 public:
   Stopwatch ()
@@ -69,17 +108,314 @@ public:
 
   void start ()
   {
-    m_start = clock ();
+    m_start = getNanoseconds ();
+    m_startCycles = getCycles ();
+  }
+
+  double getElapsedSeconds () const
+  {
+    return getElapsedNanoseconds () / 1e9;
+  }
+
+  double getElapsedNanoseconds () const
+  {
+    return getNanoseconds () - m_start;
+  }
+
+  double getElapsedCycles () const
+  {
+    return double (getCycles () - m_startCycles);
+  }
+
+  /** Returns true if getElapsedCycles () is meaningful.
+  */
+  static bool hasCycleCounter ()
+  {
+#if defined (_M_IX86) || defined (_M_X64) || defined (__i386__) || defined (__x86_64__)
+    return true;
+#else
+    return false;
+#endif
+  }
+
+  /** Returns the time of the monotonic clock in nanoseconds.
+  */
+  static double getNanoseconds ()
+  {
+#if defined (_WIN32)
+    LARGE_INTEGER frequency;
+    LARGE_INTEGER counter;
+    QueryPerformanceFrequency (&frequency);
+    QueryPerformanceCounter (&counter);
+    return double (counter.QuadPart) * 1e9 / double (frequency.QuadPart);
+
+#elif defined (__APPLE__)
+    static mach_timebase_info_data_t timebase;
+    if (timebase.denom == 0)
+      mach_timebase_info (&timebase);
+    return double (mach_absolute_time ()) * timebase.numer / timebase.denom;
+
+#else
+    timespec ts;
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return double (ts.tv_sec) * 1e9 + double (ts.tv_nsec);
+
+#endif
+  }
+
+  /** Returns the time stamp counter, or 0 if there is none.
+  */
+  static unsigned long long getCycles ()
+  {
+#if defined (_M_IX86) || defined (_M_X64) || defined (__i386__) || defined (__x86_64__)
+    return __rdtsc ();
+#else
+    return 0;
+#endif
+  }
+};
+
+//------------------------------------------------------------------------------
+/**
+  Lua allocator which counts the allocations.
+
+  A new block and a block which grows in place of a reallocation both count
+  as one allocation.
+*/
+class AllocationCounter
+{
+public:
+  AllocationCounter ()
+    : m_allocations (0)
+    , m_bytes (0)
+    , m_current (0)
+    , m_peak (0)
+  {
+  }
+
+  /** Create a Lua state which uses a counter for its allocations.
+  */
+  lua_State* newState ()
+  {
+    lua_State* L = lua_newstate (&allocate, this);
+    if (L != 0)
+      lua_atpanic (L, &panic);
+    return L;
+  }
+
+  /** Returns the counter of a state created with newState.
+  */
+  static AllocationCounter& get (lua_State* L)
+  {
+    void* ud;
+    lua_getallocf (L, &ud);
+    return *static_cast <AllocationCounter*> (ud);
+  }
+
+  unsigned long long getAllocations () const
+  {
+    return m_allocations;
+  }
+
+  unsigned long long getBytes () const
+  {
+    return m_bytes;
+  }
+
+  /** Returns the bytes in use by the state.
+  */
+  size_t getCurrentBytes () const
+  {
+    return m_current;
+  }
+
+  /** Returns the most bytes in use since the last resetPeak.
+  */
+  size_t getPeakBytes () const
+  {
+    return m_peak;
+  }
+
+  void resetPeak ()
+  {
+    m_peak = m_current;
+  }
+
+private:
+  static void* allocate (void* ud, void* ptr, size_t osize, size_t nsize)
+  {
+    AllocationCounter& counter = *static_cast <AllocationCounter*> (ud);
+
+    if (nsize == 0)
+    {
+      if (ptr != 0)
+        counter.m_current -= osize;
+      free (ptr);
+      return 0;
+    }
+
+    // When ptr is null, osize is not a size in Lua 5.2.
+    if (ptr == 0)
+    {
+      ++counter.m_allocations;
+      counter.m_bytes += nsize;
+      counter.m_current += nsize;
+    }
+    else
+    {
+      if (nsize > osize)
+      {
+        ++counter.m_allocations;
+        counter.m_bytes += nsize - osize;
+      }
+      counter.m_current += nsize;
+      counter.m_current -= osize;
+    }
+
+    counter.m_peak = std::max (counter.m_peak, counter.m_current);
+
+    return realloc (ptr, nsize);
+  }
+
+  static int panic (lua_State* L)
+  {
+    cerr << "PANIC: unprotected error in call to Lua API ("
+         << lua_tostring (L, -1) << ")" << endl;
+    return 0;
+  }
+
+  unsigned long long m_allocations;
+  unsigned long long m_bytes;
+  size_t m_current;
+  size_t m_peak;
+};
+
+//------------------------------------------------------------------------------
+/**
+  Hardware performance counters of the calling thread.
+
+  This uses perf_event_open on Linux. The counters are unavailable on other
+  platforms, or when the kernel does not allow them, for example because
+  of /proc/sys/kernel/perf_event_paranoid or in a container.
+*/
+class PerfCounters
+{
+public:
+  enum
+  {
+    instructions,
+    cycles,
+    cacheMisses,
+    branchMisses,
+    numCounters
+  };
+
+  PerfCounters () : m_isAvailable (false)
+  {
+    for (int i = 0; i < numCounters; ++i)
+    {
+      m_fd [i] = -1;
+      m_value [i] = 0;
+    }
+
+#if defined (__linux__)
+    static unsigned long long const config [numCounters] =
+    {
+      PERF_COUNT_HW_INSTRUCTIONS,
+      PERF_COUNT_HW_CPU_CYCLES,
+      PERF_COUNT_HW_CACHE_MISSES,
+      PERF_COUNT_HW_BRANCH_MISSES
+    };
+
+    m_isAvailable = true;
+    for (int i = 0; i < numCounters && m_isAvailable; ++i)
+    {
+      perf_event_attr attr;
+      memset (&attr, 0, sizeof (attr));
+      attr.type = PERF_TYPE_HARDWARE;
+      attr.size = sizeof (attr);
+      attr.config = config [i];
+      attr.disabled = 1;
+      attr.exclude_kernel = 1;
+      attr.exclude_hv = 1;
+
+      m_fd [i] = int (syscall (__NR_perf_event_open, &attr, 0, -1, -1, 0));
+      m_isAvailable = m_fd [i] != -1;
+    }
+
+    if (!m_isAvailable)
+      close ();
+#endif
+  }
+
+  ~PerfCounters ()
+  {
+    close ();
+  }
+
+  bool isAvailable () const
+  {
+    return m_isAvailable;
+  }
+
+  void start ()
+  {
+#if defined (__linux__)
+    for (int i = 0; i < numCounters && m_isAvailable; ++i)
+    {
+      ioctl (m_fd [i], PERF_EVENT_IOC_RESET, 0);
+      ioctl (m_fd [i], PERF_EVENT_IOC_ENABLE, 0);
+    }
+#endif
+  }
+
+  void stop ()
+  {
+#if defined (__linux__)
+    for (int i = 0; i < numCounters && m_isAvailable; ++i)
+    {
+      ioctl (m_fd [i], PERF_EVENT_IOC_DISABLE, 0);
+      if (read (m_fd [i], &m_value [i], sizeof (m_value [i])) != sizeof (m_value [i]))
+        m_value [i] = 0;
+    }
+#endif
+  }
+
+  /** Returns the count of the last measurement.
+  */
+  unsigned long long get (int counter) const
+  {
+    return m_value [counter];
   }
 
-  double getElapsedSeconds ()
+  static char const* getName (int counter)
   {
-    clock_t now;
-    
-    now = clock ();
+    static char const* const names [numCounters] =
+    {
+      "instr", "cycles", "cache-miss", "branch-miss"
+    };
+    return names [counter];
+  }
 
-    return (double (now - m_start)) / CLOCKS_PER_SEC;
+private:
+  void close ()
+  {
+#if defined (__linux__)
+    for (int i = 0; i < numCounters; ++i)
+    {
+      if (m_fd [i] != -1)
+        ::close (m_fd [i]);
+      m_fd [i] = -1;
+    }
+#endif
   }
+
+  PerfCounters (PerfCounters const&);
+  PerfCounters& operator= (PerfCounters const&);
+
+  bool m_isAvailable;
+  int m_fd [numCounters];
+  unsigned long long m_value [numCounters];
 };
 
 //------------------------------------------------------------------------------
@@ -105,10 +441,20 @@ struct A
   {
   }
 
+  int cmf1 () const
+  {
+    return data;
+  }
+
   virtual void vf1 ()
   {
   }
 
+  int mf4 (int a, int b) const
+  {
+    return a + b;
+  }
+
   int data;
 
   int prop;
@@ -120,67 +466,1915 @@ struct A
   {
     prop = v;
   }
+
+  static int sprop;
+  static int getsprop ()
+  {
+    return sprop;
+  }
+  static void setsprop (int v)
+  {
+    sprop = v;
+  }
+};
+
+int A::sprop = 0;
+
+// Lifetime shared with C++ through a RefCountedPtr.
+struct S
+{
+  S ()
+  {
+  }
+};
+
+// Lifetime shared through a RefCountedPtr, with an intrusive atomic count.
+struct SI : AtomicRefCountedObject
+{
+  SI ()
+  {
+  }
+};
+
+// A hierarchy for measuring the lookup of inherited member functions.
+struct H0
+{
+  void hf ()
+  {
+  }
+};
+
+struct H1 : H0
+{
+};
+
+struct H2 : H1
+{
+};
+
+struct H3 : H2
+{
 };
 
+struct H4 : H3
+{
+};
+
+struct H5 : H4
+{
+};
+
+void f0 ()
+{
+}
+
+void strArg (string const&)
+{
+}
+
+void strViewArg (StringView)
+{
+}
+
+A* getAPtr ()
+{
+  static A a;
+  return &a;
+}
+
+RefCountedPtr <S> getSPtr ()
+{
+  static RefCountedPtr <S> s (new S);
+  return s;
+}
+
+RefCountedPtr <SI> getSIPtr ()
+{
+  static RefCountedPtr <SI> s (new SI);
+  return s;
+}
+
 //------------------------------------------------------------------------------
 
 void addToState (lua_State* L)
 {
   getGlobalNamespace (L)
+    .addFunction ("f0", &f0)
+    .addFunction ("strArg", &strArg)
+    .addFunction ("strViewArg", &strViewArg)
+    .addFunction ("getAPtr", &getAPtr)
+    .addFunction ("getSPtr", &getSPtr)
+    .addFunction ("getSIPtr", &getSIPtr)
     .beginClass <A> ("A")
       .addConstructor <void (*)(void)> ()
       .addFunction ("mf1", &A::mf1)
       .addFunction ("mf2", &A::mf2)
       .addFunction ("mf3", &A::mf3)
+      .addFunction ("cmf1", &A::cmf1)
       .addFunction ("vf1", &A::vf1)
+      .addFunction ("mf4", &A::mf4)
+      .addFunction ("mf4u", &A::mf4, Unchecked ())
       .addData ("data",  &A::data)
       .addProperty ("prop", &A::getprop, &A::setprop)
+      .addStaticProperty ("sprop", &A::getsprop, &A::setsprop)
+    .endClass ()
+    .beginClass <S> ("S")
+      .addConstructor <void (*)(void), RefCountedPtr <S> > ()
+    .endClass ()
+    .beginClass <SI> ("SI")
+      .addConstructor <void (*)(void), RefCountedPtr <SI> > ()
+    .endClass ()
+    .beginClass <H0> ("H0")
+      .addFunction ("hf", &H0::hf)
+    .endClass ()
+    .deriveClass <H1, H0> ("H1")
+      .addConstructor <void (*)(void)> ()
+    .endClass ()
+    .deriveClass <H2, H1> ("H2")
+      .addConstructor <void (*)(void)> ()
+    .endClass ()
+    .deriveClass <H3, H2> ("H3")
+      .addConstructor <void (*)(void)> ()
+    .endClass ()
+    .deriveClass <H4, H3> ("H4")
+      .addConstructor <void (*)(void)> ()
+    .endClass ()
+    .deriveClass <H5, H4> ("H5")
+      .addConstructor <void (*)(void)> ()
     .endClass ()
     ;
+
+  luaL_dostring (L, "a = A (); h1 = H1 (); h2 = H2 (); h3 = H3 (); h4 = H4 (); h5 = H5 ()");
 }
 
-void runTests (lua_State* L)
+//------------------------------------------------------------------------------
+/**
+  Hand-written bindings for some of the functions and for class A.
+
+  These are written the way a binding without LuaBridge usually looks, and
+  are the baseline for measuring the overhead of LuaBridge. The class is a
+  plain userdata holding an A, with a metatable from luaL_newmetatable.
+*/
+namespace HandWritten
 {
-  cout.precision (4);
 
-  int result;
+char const* const className = "RawA";
 
-  luaL_dostring (L, "a = A()");
+int f0 (lua_State*)
+{
+  SpeedTests::f0 ();
+  return 0;
+}
 
-  int const trials = 5;
+int strArg (lua_State* L)
+{
+  size_t length;
+  char const* const s = luaL_checklstring (L, 1, &length);
+  SpeedTests::strArg (string (s, length));
+  return 0;
+}
 
-  for (int trial = 0; trial < trials; ++trial)
-  {
-    result = luaL_loadstring (L, "a:mf1 ()");
-    if (result != 0)
-      lua_error (L);
+A* checkA (lua_State* L)
+{
+  return static_cast <A*> (luaL_checkudata (L, 1, className));
+}
 
-    int const N = 10000000;
+int construct (lua_State* L)
+{
+  new (lua_newuserdata (L, sizeof (A))) A;
+  luaL_getmetatable (L, className);
+  lua_setmetatable (L, -2);
+  return 1;
+}
 
-    Stopwatch sw;
+int mf1 (lua_State* L)
+{
+  checkA (L)->mf1 ();
+  return 0;
+}
 
-    sw.start ();
-    for (int i = 0; i < N; ++i)
-    {
-      lua_pushvalue (L, -1);
-      lua_call (L, 0, 0);
-    }
+int mf4 (lua_State* L)
+{
+  A* const a = checkA (L);
+  lua_pushinteger (L, a->mf4 (int (luaL_checkinteger (L, 2)),
+                              int (luaL_checkinteger (L, 3))));
+  return 1;
+}
 
-    double const seconds = sw.getElapsedSeconds ();
+// The methods table is the upvalue. Fields are looked up after methods.
+int index (lua_State* L)
+{
+  A* const a = checkA (L);
 
-    cout << "Elapsed time: " << seconds << endl;
-  }
+  lua_pushvalue (L, 2);
+  lua_rawget (L, lua_upvalueindex (1));
+  if (!lua_isnil (L, -1))
+    return 1;
+  lua_pop (L, 1);
+
+  char const* const key = luaL_checkstring (L, 2);
+  if (!strcmp (key, "prop"))
+    lua_pushinteger (L, a->getprop ());
+  else if (!strcmp (key, "data"))
+    lua_pushinteger (L, a->data);
+  else
+    lua_pushnil (L);
+  return 1;
+}
+
+int newindex (lua_State* L)
+{
+  A* const a = checkA (L);
+
+  char const* const key = luaL_checkstring (L, 2);
+  if (!strcmp (key, "prop"))
+    a->setprop (int (luaL_checkinteger (L, 3)));
+  else if (!strcmp (key, "data"))
+    a->data = int (luaL_checkinteger (L, 3));
+  else
+    return luaL_error (L, "no writable member '%s'", key);
+  return 0;
+}
+
+void addToState (lua_State* L)
+{
+  getGlobalNamespace (L)
+    .addCFunction ("f0Raw", &f0)
+    .addCFunction ("strArgRaw", &strArg)
+    ;
+
+  luaL_newmetatable (L, className);
+  lua_newtable (L);
+  lua_pushcfunction (L, &mf1);
+  lua_setfield (L, -2, "mf1");
+  lua_pushcfunction (L, &mf4);
+  lua_setfield (L, -2, "mf4");
+  lua_pushcclosure (L, &index, 1);
+  lua_setfield (L, -2, "__index");
+  lua_pushcfunction (L, &newindex);
+  lua_setfield (L, -2, "__newindex");
+  lua_pop (L, 1);
+
+  lua_register (L, className, &construct);
+
+  luaL_dostring (L, "r = RawA ()");
 }
 
 }
 
-void runSpeedTests ()
+//------------------------------------------------------------------------------
+/**
+  A micro-benchmark.
+
+  The operation is a Lua statement which is run in a loop, after the setup
+  statements. Both may use the globals created by addToState.
+
+  A benchmark which touches process-wide state, such as the static data of
+  a class or the reference counts of RefCountedPtr, is marked as shared. The
+  scaling benchmark leaves those out, since they race between threads.
+*/
+struct Benchmark
 {
-  lua_State* L = luaL_newstate ();
-  luaL_openlibs (L);
+  char const* name;
+  char const* setup;
+  char const* operation;
+  bool isShared;
+};
 
-  SpeedTests::addToState (L);
-  SpeedTests::runTests (L);
+Benchmark const benchmarks [] =
+{
+  { "empty loop",             "",                      "",                     false },
+  { "free function",          "local f0 = f0",         "f0 ()",                false },
+  { "member function",        "local a = a",           "a:mf1 ()",             false },
+  { "const member function",  "local a = a",           "a:cmf1 ()",            false },
+  { "virtual function",       "local a = a",           "a:vf1 ()",             false },
+  { "pointer argument",       "local a = a",           "a:mf2 (a)",            false },
+  { "reference argument",     "local a = a",           "a:mf3 (a)",            false },
+  { "checked 2 args",         "local a = a",           "a:mf4 (1, 2)",         false },
+  { "unchecked 2 args",       "local a = a",           "a:mf4u (1, 2)",        false },
+  { "data get",               "local a = a",           "local x = a.data",     false },
+  { "data set",               "local a = a",           "a.data = i",           false },
+  { "property get",           "local a = a",           "local x = a.prop",     false },
+  { "property set",           "local a = a",           "a.prop = i",           false },
+  { "static property get",    "local A = A",           "local x = A.sprop",    true },
+  { "static property set",    "local A = A",           "A.sprop = i",          true },
+  { "construct by value",     "local A = A",           "local x = A ()",       false },
+  { "construct container",    "local S = S",           "local x = S ()",       true },
+  { "push pointer",           "local f = getAPtr",     "local x = f ()",       false },
+  { "push container",         "local f = getSPtr",     "local x = f ()",       true },
+  { "construct intrusive",    "local S = SI",          "local x = S ()",       false },
+  { "push intrusive",         "local f = getSIPtr",    "local x = f ()",       false },
+  { "std::string argument",   "local f = strArg",      "f (\"Hello, world\")", false },
+  { "StringView argument",    "local f = strViewArg",  "f (\"Hello, world\")", false },
+  { "inherited depth 1",      "local h = h1",          "h:hf ()",              false },
+  { "inherited depth 2",      "local h = h2",          "h:hf ()",              false },
+  { "inherited depth 3",      "local h = h3",          "h:hf ()",              false },
+  { "inherited depth 4",      "local h = h4",          "h:hf ()",              false },
+  { "inherited depth 5",      "local h = h5",          "h:hf ()",              false }
+};
 
-  lua_close (L);
+//------------------------------------------------------------------------------
+/**
+  Operations which leave garbage behind, for the GC benchmark.
+*/
+Benchmark const churnBenchmarks [] =
+{
+  { "construct by value",     "local A = A",           "local x = A ()",       false },
+  { "construct container",    "local S = S",           "local x = S ()",       true },
+  { "push pointer",           "local f = getAPtr",     "local x = f ()",       false },
+  { "push container",         "local f = getSPtr",     "local x = f ()",       true },
+  { "construct intrusive",    "local S = SI",          "local x = S ()",       false },
+  { "push intrusive",         "local f = getSIPtr",    "local x = f ()",       false }
+};
+
+//------------------------------------------------------------------------------
+/**
+  The same operation through LuaBridge and through a hand-written binding.
+*/
+struct OverheadBenchmark
+{
+  char const* name;
+  char const* setup;
+  char const* operation;
+  char const* handWrittenSetup;
+  char const* handWrittenOperation;
+};
+
+OverheadBenchmark const overheadBenchmarks [] =
+{
+  { "free function",   "local f = f0",       "f ()",
+                       "local f = f0Raw",    "f ()" },
+  { "string argument", "local f = strArg",   "f (\"Hello, world\")",
+                       "local f = strArgRaw", "f (\"Hello, world\")" },
+  { "construct",       "local A = A",        "local x = A ()",
+                       "local A = RawA",     "local x = A ()" },
+  { "member function", "local a = a",        "a:mf1 ()",
+                       "local a = r",        "a:mf1 ()" },
+  { "member 2 args",   "local a = a",        "a:mf4 (1, 2)",
+                       "local a = r",        "a:mf4 (1, 2)" },
+  { "data get",        "local a = a",        "local x = a.data",
+                       "local a = r",        "local x = a.data" },
+  { "data set",        "local a = a",        "a.data = i",
+                       "local a = r",        "a.data = i" },
+  { "property get",    "local a = a",        "local x = a.prop",
+                       "local a = r",        "local x = a.prop" },
+  { "property set",    "local a = a",        "a.prop = i",
+                       "local a = r",        "a.prop = i" }
+};
+
+//------------------------------------------------------------------------------
+/**
+  Options for running the benchmarks.
+*/
+struct Options
+{
+  enum Format
+  {
+    text,
+    json,
+    csv
+  };
+
+  Options ()
+    : iterations (1000000)
+    , trials (11)
+    , format (text)
+    , scaling (false)
+    , threads (0)
+    , gc (false)
+    , registration (false)
+    , overhead (false)
+    , help (false)
+    , threshold (5)
+  {
+  }
+
+  int iterations;
+  int trials;
+  Format format;
+
+  // File for the json or csv output, instead of stdout.
+  string output;
+
+  // Baseline file to compare against, written by a run with --format json.
+  string compare;
+
+  // Result files of several builds to show side by side, instead of running.
+  vector <string> matrix;
+
+  // Run the multi-threaded scaling benchmark up to this many threads,
+  // or up to the number of hardware threads if it is zero.
+  bool scaling;
+  int threads;
+
+  // Run the GC benchmark instead.
+  bool gc;
+
+  // Run the registration benchmark instead.
+  bool registration;
+
+  // Compare LuaBridge with hand-written bindings instead.
+  bool overhead;
+
+  // Show the options instead.
+  bool help;
+
+  // Smallest change of the mean, in percent, that is reported.
+  double threshold;
+};
+
+//------------------------------------------------------------------------------
+/**
+  The results of a benchmark, in nanoseconds per operation.
+*/
+struct Result
+{
+  string name;
+  double median;
+  double p99;
+  double mean;
+  double stddev;
+  int trials;
+
+  // Medians of the allocations and allocated bytes.
+  double allocations;
+  double bytes;
+
+  // Medians of the time stamp cycles and of the hardware counters.
+  double cycles;
+  double counters [PerfCounters::numCounters];
+};
+
+//------------------------------------------------------------------------------
+/**
+  A measurement of one trial, per operation.
+*/
+struct Sample
+{
+  double nanoseconds;
+  double allocations;
+  double bytes;
+  double cycles;
+  double counters [PerfCounters::numCounters];
+};
+
+//------------------------------------------------------------------------------
+/**
+  Get the value at the given percentile of sorted samples, by nearest rank.
+*/
+double percentile (vector <double> const& sorted, double p)
+{
+  size_t rank = size_t (p / 100 * sorted.size () + 0.5);
+  if (rank < 1)
+    rank = 1;
+  if (rank > sorted.size ())
+    rank = sorted.size ();
+  return sorted [rank - 1];
+}
+
+//------------------------------------------------------------------------------
+/**
+  Get the median of one field of the samples.
+*/
+double median (vector <Sample> const& samples, double (*field) (Sample const&))
+{
+  vector <double> values;
+  for (size_t i = 0; i < samples.size (); ++i)
+    values.push_back (field (samples [i]));
+  sort (values.begin (), values.end ());
+  return percentile (values, 50);
+}
+
+double getAllocations (Sample const& sample)
+{
+  return sample.allocations;
+}
+
+double getBytes (Sample const& sample)
+{
+  return sample.bytes;
+}
+
+double getCycles (Sample const& sample)
+{
+  return sample.cycles;
+}
+
+template <int counter>
+double getCounter (Sample const& sample)
+{
+  return sample.counters [counter];
+}
+
+//------------------------------------------------------------------------------
+/**
+  Time a loop function which is on top of the stack.
+*/
+Sample timeLoop (lua_State* L, int iterations, PerfCounters& counters)
+{
+  lua_pushvalue (L, -1);
+  lua_pushinteger (L, iterations);
+
+  AllocationCounter const& allocator = AllocationCounter::get (L);
+  unsigned long long const allocations = allocator.getAllocations ();
+  unsigned long long const bytes = allocator.getBytes ();
+
+  Stopwatch sw;
+
+  counters.start ();
+  sw.start ();
+  lua_call (L, 1, 0);
+  double const nanoseconds = sw.getElapsedNanoseconds ();
+  double const cycles = sw.getElapsedCycles ();
+  counters.stop ();
+
+  Sample sample;
+  sample.nanoseconds = nanoseconds / iterations;
+  sample.allocations = double (allocator.getAllocations () - allocations) / iterations;
+  sample.bytes = double (allocator.getBytes () - bytes) / iterations;
+  sample.cycles = cycles / iterations;
+  for (int i = 0; i < PerfCounters::numCounters; ++i)
+    sample.counters [i] = double (counters.get (i)) / iterations;
+  return sample;
+}
+
+//------------------------------------------------------------------------------
+/**
+  Push the loop function of a benchmark, which takes the iteration count.
+*/
+void loadBenchmark (lua_State* L, Benchmark const& b)
+{
+  string const chunk = string ("local n = ...\n") + b.setup +
+    "\nfor i = 1, n do " + b.operation + " end\n";
+
+  if (luaL_loadstring (L, chunk.c_str ()) != 0)
+    lua_error (L);
+}
+
+//------------------------------------------------------------------------------
+/**
+  Reduce the samples of a benchmark to its result.
+*/
+Result summarize (string const& name, vector <Sample> const& samples)
+{
+  vector <double> times;
+  for (size_t i = 0; i < samples.size (); ++i)
+    times.push_back (samples [i].nanoseconds);
+  sort (times.begin (), times.end ());
+
+  double sum = 0;
+  for (size_t i = 0; i < times.size (); ++i)
+    sum += times [i];
+  double const mean = sum / times.size ();
+
+  double squares = 0;
+  for (size_t i = 0; i < times.size (); ++i)
+    squares += (times [i] - mean) * (times [i] - mean);
+
+  Result result;
+  result.name = name;
+  result.median = percentile (times, 50);
+  result.p99 = percentile (times, 99);
+  result.mean = mean;
+  result.stddev = times.size () > 1 ? sqrt (squares / (times.size () - 1)) : 0;
+  result.trials = int (times.size ());
+  result.allocations = median (samples, &getAllocations);
+  result.bytes = median (samples, &getBytes);
+  result.cycles = median (samples, &getCycles);
+  result.counters [PerfCounters::instructions] =
+    median (samples, &getCounter <PerfCounters::instructions>);
+  result.counters [PerfCounters::cycles] =
+    median (samples, &getCounter <PerfCounters::cycles>);
+  result.counters [PerfCounters::cacheMisses] =
+    median (samples, &getCounter <PerfCounters::cacheMisses>);
+  result.counters [PerfCounters::branchMisses] =
+    median (samples, &getCounter <PerfCounters::branchMisses>);
+  return result;
+}
+
+//------------------------------------------------------------------------------
+/**
+  Run a benchmark after a warmup, and measure it in a number of trials.
+*/
+Result runBenchmark (lua_State* L, Benchmark const& b, Options const& options,
+                     PerfCounters& counters)
+{
+  loadBenchmark (L, b);
+
+  timeLoop (L, std::max (options.iterations / 10, 1), counters);
+
+  vector <Sample> samples;
+  for (int trial = 0; trial < options.trials; ++trial)
+    samples.push_back (timeLoop (L, options.iterations, counters));
+
+  lua_pop (L, 1);
+  lua_gc (L, LUA_GCCOLLECT, 0);
+
+  return summarize (b.name, samples);
+}
+
+//------------------------------------------------------------------------------
+/**
+  Timing API for the benchmark script, bound through LuaBridge.
+
+  The script calls start before a loop, and stop with the name and the
+  iteration count after it. The samples of each name are collected over
+  repeated runs of the script.
+*/
+class ScriptReport
+{
+public:
+  ScriptReport (lua_State* L, PerfCounters& counters)
+    : m_allocator (AllocationCounter::get (L))
+    , m_counters (counters)
+    , m_allocations (0)
+    , m_bytes (0)
+  {
+  }
+
+  void start ()
+  {
+    m_allocations = m_allocator.getAllocations ();
+    m_bytes = m_allocator.getBytes ();
+    m_counters.start ();
+    m_stopwatch.start ();
+  }
+
+  void stop (string const& name, int iterations)
+  {
+    double const nanoseconds = m_stopwatch.getElapsedNanoseconds ();
+    double const cycles = m_stopwatch.getElapsedCycles ();
+    m_counters.stop ();
+
+    iterations = std::max (iterations, 1);
+
+    Sample sample;
+    sample.nanoseconds = nanoseconds / iterations;
+    sample.allocations = double (m_allocator.getAllocations () - m_allocations) / iterations;
+    sample.bytes = double (m_allocator.getBytes () - m_bytes) / iterations;
+    sample.cycles = cycles / iterations;
+    for (int i = 0; i < PerfCounters::numCounters; ++i)
+      sample.counters [i] = double (m_counters.get (i)) / iterations;
+
+    size_t i = 0;
+    while (i < m_names.size () && m_names [i] != name)
+      ++i;
+
+    if (i == m_names.size ())
+    {
+      m_names.push_back (name);
+      m_samples.push_back (vector <Sample> ());
+    }
+
+    m_samples [i].push_back (sample);
+  }
+
+  /** Returns the results in the order the script first reported them.
+  */
+  vector <Result> getResults (string const& prefix) const
+  {
+    vector <Result> results;
+    for (size_t i = 0; i < m_names.size (); ++i)
+      results.push_back (summarize (prefix + m_names [i], m_samples [i]));
+    return results;
+  }
+
+private:
+  ScriptReport (ScriptReport const&);
+  ScriptReport& operator= (ScriptReport const&);
+
+  AllocationCounter const& m_allocator;
+  PerfCounters& m_counters;
+  Stopwatch m_stopwatch;
+  unsigned long long m_allocations;
+  unsigned long long m_bytes;
+  vector <string> m_names;
+  vector <vector <Sample> > m_samples;
+};
+
+//------------------------------------------------------------------------------
+/**
+  Run the benchmark script, once for each trial.
+
+  @returns false if the script failed.
+*/
+bool runScript (lua_State* L, Options const& options, PerfCounters& counters,
+                vector <Result>& results)
+{
+  getGlobalNamespace (L)
+    .beginClass <ScriptReport> ("ScriptReport")
+      .addFunction ("start", &ScriptReport::start)
+      .addFunction ("stop", &ScriptReport::stop)
+    .endClass ()
+    ;
+
+  ScriptReport report (L, counters);
+
+  for (int trial = 0; trial < options.trials; ++trial)
+  {
+    if (luaL_loadbuffer (L, BinaryData::SpeedTests_lua,
+          BinaryData::SpeedTests_luaSize, "SpeedTests.lua") != 0)
+    {
+      cerr << lua_tostring (L, -1) << endl;
+      lua_pop (L, 1);
+      return false;
+    }
+
+    lua_pushinteger (L, options.iterations);
+    push (L, &report);
+
+    if (lua_pcall (L, 2, 0, 0) != 0)
+    {
+      cerr << lua_tostring (L, -1) << endl;
+      lua_pop (L, 1);
+      return false;
+    }
+
+    lua_gc (L, LUA_GCCOLLECT, 0);
+  }
+
+  vector <Result> const scriptResults = report.getResults ("script ");
+  results.insert (results.end (), scriptResults.begin (), scriptResults.end ());
+  return true;
+}
+
+//------------------------------------------------------------------------------
+/**
+  Quote a string for JSON or CSV output.
+*/
+string quote (string const& s)
+{
+  string result ("\"");
+  for (size_t i = 0; i < s.size (); ++i)
+  {
+    if (s [i] == '"' || s [i] == '\\')
+      result += '\\';
+    result += s [i];
+  }
+  return result + "\"";
+}
+
+//------------------------------------------------------------------------------
+/**
+  Write the results as a JSON document.
+*/
+void writeJson (ostream& os, vector <Result> const& results,
+                Options const& options, bool hasCycles, bool hasCounters)
+{
+  os << "{\n"
+     << "  \"lua\": " << quote (LUA_VERSION) << ",\n"
+     << "  \"iterations\": " << options.iterations << ",\n"
+     << "  \"trials\": " << options.trials << ",\n"
+     << "  \"results\": [\n";
+
+  for (size_t i = 0; i < results.size (); ++i)
+  {
+    Result const& r = results [i];
+
+    os << "    { \"name\": " << quote (r.name)
+       << ", \"median\": " << r.median
+       << ", \"mean\": " << r.mean
+       << ", \"stddev\": " << r.stddev
+       << ", \"p99\": " << r.p99
+       << ", \"trials\": " << r.trials
+       << ", \"allocations\": " << r.allocations
+       << ", \"bytes\": " << r.bytes;
+    if (hasCycles)
+      os << ", \"tsc\": " << r.cycles;
+    if (hasCounters)
+    {
+      for (int c = 0; c < PerfCounters::numCounters; ++c)
+        os << ", " << quote (PerfCounters::getName (c)) << ": " << r.counters [c];
+    }
+    os << " }" << (i + 1 < results.size () ? "," : "") << "\n";
+  }
+
+  os << "  ]\n"
+     << "}\n";
+}
+
+//------------------------------------------------------------------------------
+/**
+  Write the results as CSV, one row per benchmark.
+*/
+void writeCsv (ostream& os, vector <Result> const& results,
+               bool hasCycles, bool hasCounters)
+{
+  os << "name,lua,median,mean,stddev,p99,trials,allocations,bytes";
+  if (hasCycles)
+    os << ",tsc";
+  if (hasCounters)
+  {
+    for (int c = 0; c < PerfCounters::numCounters; ++c)
+      os << "," << PerfCounters::getName (c);
+  }
+  os << "\n";
+
+  for (size_t i = 0; i < results.size (); ++i)
+  {
+    Result const& r = results [i];
+
+    os << quote (r.name) << "," << quote (LUA_VERSION)
+       << "," << r.median << "," << r.mean << "," << r.stddev
+       << "," << r.p99 << "," << r.trials
+       << "," << r.allocations << "," << r.bytes;
+    if (hasCycles)
+      os << "," << r.cycles;
+    if (hasCounters)
+    {
+      for (int c = 0; c < PerfCounters::numCounters; ++c)
+        os << "," << r.counters [c];
+    }
+    os << "\n";
+  }
+}
+
+//------------------------------------------------------------------------------
+/**
+  Get the JSON value which starts at or after pos as text.
+*/
+string getJsonValue (string const& object, size_t pos)
+{
+  pos = object.find_first_not_of (" \t\r\n", pos);
+  if (pos == string::npos)
+    return string ();
+
+  if (object [pos] == '"')
+  {
+    string value;
+    for (++pos; pos < object.size () && object [pos] != '"'; ++pos)
+    {
+      if (object [pos] == '\\' && pos + 1 < object.size ())
+        ++pos;
+      value += object [pos];
+    }
+    return value;
+  }
+
+  size_t const end = object.find_first_of (",} \t\r\n", pos);
+  return object.substr (pos, end == string::npos ? string::npos : end - pos);
+}
+
+//------------------------------------------------------------------------------
+/**
+  Get a field of a JSON object as text, or an empty string if it is missing.
+
+  The key only matches where a key may appear, after the opening brace or a
+  comma and before a colon, so the same text inside a value is skipped.
+*/
+string getJsonField (string const& object, string const& key)
+{
+  string const name = quote (key);
+
+  for (size_t pos = object.find (name); pos != string::npos; pos = object.find (name, pos + 1))
+  {
+    size_t const before = pos == 0 ? string::npos : object.find_last_not_of (" \t\r\n", pos - 1);
+    size_t const after = object.find_first_not_of (" \t\r\n", pos + name.size ());
+
+    if (before != string::npos && (object [before] == '{' || object [before] == ',') &&
+        after != string::npos && object [after] == ':')
+      return getJsonValue (object, after + 1);
+  }
+
+  return string ();
+}
+
+//------------------------------------------------------------------------------
+/**
+  Read the results of a file written with --format json.
+
+  This only understands the layout produced by writeJson, where each result
+  is a flat object in the "results" array.
+*/
+bool readJson (string const& path, vector <Result>& results, string& lua)
+{
+  ifstream is (path.c_str ());
+  if (!is)
+    return false;
+
+  stringstream ss;
+  ss << is.rdbuf ();
+  string const text = ss.str ();
+
+  size_t pos = text.find ("\"results\"");
+  if (pos == string::npos)
+    return false;
+
+  lua = getJsonField (text.substr (0, pos), "lua");
+
+  for (;;)
+  {
+    size_t const begin = text.find ('{', pos);
+    if (begin == string::npos)
+      break;
+
+    size_t const end = text.find ('}', begin);
+    if (end == string::npos)
+      break;
+
+    string const object = text.substr (begin, end - begin + 1);
+
+    Result r;
+    r.name = getJsonField (object, "name");
+    r.median = atof (getJsonField (object, "median").c_str ());
+    r.mean = atof (getJsonField (object, "mean").c_str ());
+    r.stddev = atof (getJsonField (object, "stddev").c_str ());
+    r.p99 = atof (getJsonField (object, "p99").c_str ());
+    r.trials = atoi (getJsonField (object, "trials").c_str ());
+    r.allocations = atof (getJsonField (object, "allocations").c_str ());
+    r.bytes = atof (getJsonField (object, "bytes").c_str ());
+    r.cycles = 0;
+    for (int c = 0; c < PerfCounters::numCounters; ++c)
+      r.counters [c] = 0;
+    results.push_back (r);
+
+    pos = end + 1;
+  }
+
+  return true;
+}
+
+//------------------------------------------------------------------------------
+/**
+  Compare results against a baseline and report the significant changes.
+
+  A change is significant when the mean moved by more than the threshold
+  percentage, and by more than three standard errors of the difference
+  (Welch's t statistic). The trial counts are usually too small for an
+  exact t distribution, so the cutoff is deliberately conservative.
+
+  @returns The number of regressions.
+*/
+int compareResults (ostream& os, vector <Result> const& baseline,
+                    vector <Result> const& results, double threshold)
+{
+  int regressions = 0;
+
+  os << setw (24) << left << "benchmark"
+     << setw (12) << right << "baseline"
+     << setw (12) << right << "current"
+     << setw (12) << right << "change %"
+     << setw (8) << right << "t"
+     << endl;
+
+  for (size_t i = 0; i < results.size (); ++i)
+  {
+    Result const& r = results [i];
+
+    size_t j = 0;
+    while (j < baseline.size () && baseline [j].name != r.name)
+      ++j;
+
+    if (j == baseline.size ())
+    {
+      os << setw (24) << left << r.name << "  not in baseline" << endl;
+      continue;
+    }
+
+    Result const& b = baseline [j];
+
+    double const change = b.mean > 0 ? (r.mean - b.mean) / b.mean * 100 : 0;
+
+    double const error = sqrt (
+      (b.trials > 0 ? b.stddev * b.stddev / b.trials : 0) +
+      (r.trials > 0 ? r.stddev * r.stddev / r.trials : 0));
+
+    double t;
+    if (error > 0)
+      t = (r.mean - b.mean) / error;
+    else
+      t = r.mean > b.mean ? HUGE_VAL : (r.mean < b.mean ? -HUGE_VAL : 0);
+
+    char const* verdict = "";
+    if (fabs (change) > threshold && fabs (t) > 3)
+    {
+      if (change > 0)
+      {
+        verdict = "  REGRESSION";
+        ++regressions;
+      }
+      else
+      {
+        verdict = "  improvement";
+      }
+    }
+
+    os << setw (24) << left << r.name
+       << setw (12) << right << b.mean
+       << setw (12) << right << r.mean
+       << setw (12) << right << change
+       << setw (8) << right << t
+       << verdict;
+
+    // Allocation counts are deterministic, so any change is worth seeing.
+    if (fabs (r.allocations - b.allocations) >= 0.01)
+      os << "  allocations " << b.allocations << " -> " << r.allocations;
+
+    os << endl;
+  }
+
+  os << regressions << " regressions" << endl;
+
+  return regressions;
+}
+
+//------------------------------------------------------------------------------
+/**
+  Show the results of several builds side by side.
+
+  The unity build links exactly one Lua, so each version is measured by its
+  own build with --format json. The last column is the ratio of the median
+  times of the last file to the first.
+*/
+int showMatrix (vector <string> const& paths)
+{
+  vector <vector <Result> > columns;
+  vector <string> names;
+
+  for (size_t i = 0; i < paths.size (); ++i)
+  {
+    vector <Result> results;
+    string lua;
+    if (!readJson (paths [i], results, lua))
+    {
+      cerr << "Can't read " << paths [i] << endl;
+      return 1;
+    }
+    columns.push_back (results);
+    names.push_back (lua.empty () ? paths [i] : lua);
+  }
+
+  if (columns.empty ())
+    return 0;
+
+  cout << setw (24) << left << "median ns";
+  for (size_t c = 0; c < names.size (); ++c)
+    cout << setw (12) << right << names [c];
+  if (columns.size () > 1)
+    cout << setw (12) << right << "ratio";
+  cout << endl;
+
+  cout << fixed << setprecision (2);
+
+  vector <Result> const& first = columns.front ();
+
+  for (size_t i = 0; i < first.size (); ++i)
+  {
+    cout << setw (24) << left << first [i].name;
+
+    double last = 0;
+    for (size_t c = 0; c < columns.size (); ++c)
+    {
+      size_t j = 0;
+      while (j < columns [c].size () && columns [c][j].name != first [i].name)
+        ++j;
+
+      if (j < columns [c].size ())
+      {
+        last = columns [c][j].median;
+        cout << setw (12) << right << last;
+      }
+      else
+      {
+        last = 0;
+        cout << setw (12) << right << "-";
+      }
+    }
+
+    if (columns.size () > 1)
+    {
+      if (last > 0 && first [i].median > 0)
+        cout << setw (12) << right << last / first [i].median;
+      else
+        cout << setw (12) << right << "-";
+    }
+
+    cout << endl;
+  }
+
+  return 0;
+}
+
+//------------------------------------------------------------------------------
+/**
+  Minimal thread which runs a function until it is joined.
+*/
+class Thread
+{
+public:
+  typedef void (*Function) (void* arg);
+
+  Thread (Function function, void* arg)
+    : m_function (function)
+    , m_arg (arg)
+  {
+#if defined (_WIN32)
+    m_handle = CreateThread (0, 0, &entry, this, 0, 0);
+#else
+    pthread_create (&m_handle, 0, &entry, this);
+#endif
+  }
+
+  void join ()
+  {
+#if defined (_WIN32)
+    WaitForSingleObject (m_handle, INFINITE);
+    CloseHandle (m_handle);
+#else
+    pthread_join (m_handle, 0);
+#endif
+  }
+
+  /** Returns the number of hardware threads.
+  */
+  static int getHardwareThreads ()
+  {
+#if defined (_WIN32)
+    SYSTEM_INFO info;
+    GetSystemInfo (&info);
+    return std::max (int (info.dwNumberOfProcessors), 1);
+#else
+    return std::max (int (sysconf (_SC_NPROCESSORS_ONLN)), 1);
+#endif
+  }
+
+private:
+#if defined (_WIN32)
+  static DWORD WINAPI entry (LPVOID thread)
+  {
+    static_cast <Thread*> (thread)->m_function (static_cast <Thread*> (thread)->m_arg);
+    return 0;
+  }
+
+  HANDLE m_handle;
+#else
+  static void* entry (void* thread)
+  {
+    static_cast <Thread*> (thread)->m_function (static_cast <Thread*> (thread)->m_arg);
+    return 0;
+  }
+
+  pthread_t m_handle;
+#endif
+
+  Thread (Thread const&);
+  Thread& operator= (Thread const&);
+
+  Function m_function;
+  void* m_arg;
+};
+
+//------------------------------------------------------------------------------
+/**
+  A thread of the scaling benchmark, with its own Lua state.
+
+  The state is prepared on the main thread, then used only by the worker
+  thread until it is joined.
+*/
+struct Worker
+{
+  explicit Worker (int iterations_)
+    : iterations (iterations_)
+  {
+    L = allocator.newState ();
+    luaL_openlibs (L);
+    addToState (L);
+
+    for (size_t i = 0; i < sizeof (benchmarks) / sizeof (benchmarks [0]); ++i)
+    {
+      if (!benchmarks [i].isShared)
+        loadBenchmark (L, benchmarks [i]);
+    }
+  }
+
+  ~Worker ()
+  {
+    lua_close (L);
+  }
+
+  /** Run each loop function on the stack.
+  */
+  static void run (void* arg)
+  {
+    Worker& w = *static_cast <Worker*> (arg);
+
+    for (int i = 1; i <= lua_gettop (w.L); ++i)
+    {
+      lua_pushvalue (w.L, i);
+      lua_pushinteger (w.L, w.iterations);
+      lua_call (w.L, 1, 0);
+    }
+  }
+
+  AllocationCounter allocator;
+  lua_State* L;
+  int iterations;
+};
+
+//------------------------------------------------------------------------------
+/**
+  Measure the aggregate throughput of one Lua state per thread.
+
+  Each thread runs every benchmark which is not shared, on its own state.
+  The efficiency is the throughput divided by the thread count times the
+  throughput of one thread. When it drops well below one while there are
+  enough hardware threads, the threads contend for something shared.
+*/
+int runScaling (Options const& options)
+{
+  int const hardwareThreads = Thread::getHardwareThreads ();
+  int const maxThreads = options.threads > 0 ? options.threads : hardwareThreads;
+  int const iterations = std::max (options.iterations / 10, 1);
+
+  int loops = 0;
+  for (size_t i = 0; i < sizeof (benchmarks) / sizeof (benchmarks [0]); ++i)
+  {
+    if (!benchmarks [i].isShared)
+      ++loops;
+  }
+
+  cout << LUA_VERSION << ", " << iterations << " iterations of " << loops
+       << " benchmarks per thread, " << options.trials << " trials, "
+       << hardwareThreads << " hardware threads" << endl;
+
+  cout << setw (12) << left << "threads"
+       << setw (12) << right << "median ms"
+       << setw (12) << right << "Mops/s"
+       << setw (12) << right << "efficiency" << endl;
+
+  cout << fixed << setprecision (2);
+
+  // Warm up the process before the first measurement.
+  {
+    Worker warmup (iterations);
+    Worker::run (&warmup);
+  }
+
+  double single = 0;
+
+  for (int threads = 1; threads <= maxThreads; threads = threads < maxThreads ?
+       std::min (threads * 2, maxThreads) : maxThreads + 1)
+  {
+    vector <double> times;
+
+    for (int trial = 0; trial < options.trials; ++trial)
+    {
+      vector <Worker*> workers;
+      for (int i = 0; i < threads; ++i)
+        workers.push_back (new Worker (iterations));
+
+      vector <Thread*> running;
+
+      Stopwatch sw;
+
+      for (int i = 0; i < threads; ++i)
+        running.push_back (new Thread (&Worker::run, workers [i]));
+
+      for (int i = 0; i < threads; ++i)
+      {
+        running [i]->join ();
+        delete running [i];
+      }
+
+      times.push_back (sw.getElapsedSeconds ());
+
+      for (int i = 0; i < threads; ++i)
+        delete workers [i];
+    }
+
+    sort (times.begin (), times.end ());
+    double const seconds = percentile (times, 50);
+    double const throughput = double (threads) * loops * iterations / seconds;
+
+    if (threads == 1)
+      single = throughput;
+
+    double const efficiency = throughput / (single * threads);
+
+    cout << setw (12) << left << threads
+         << setw (12) << right << seconds * 1000
+         << setw (12) << right << throughput / 1e6
+         << setw (12) << right << efficiency;
+
+    if (threads > hardwareThreads)
+      cout << "  oversubscribed";
+    else if (efficiency < 0.75)
+      cout << "  contention";
+
+    cout << endl;
+  }
+
+  return 0;
+}
+
+//------------------------------------------------------------------------------
+/**
+  Measure the garbage collection of bound objects which are thrown away.
+
+  The automatic collector is stopped, and the loop runs in batches. After
+  each batch the collector is stepped by hand, with a debt equal to what
+  the batch allocated, which paces it like the automatic collector while
+  making each step visible to the stopwatch. The pauses are the durations
+  of these steps.
+*/
+int runGcBenchmark (Options const& options)
+{
+  int const batch = 1000;
+  int const batches = std::max (options.iterations / batch, 1);
+
+  cout << LUA_VERSION << ", " << batches * batch << " objects in batches of "
+       << batch << endl;
+
+  cout << setw (24) << left << "benchmark"
+       << setw (12) << right << "total ms"
+       << setw (12) << right << "gc ms"
+       << setw (10) << right << "steps"
+       << setw (10) << right << "cycles"
+       << setw (12) << right << "max us"
+       << setw (12) << right << "p99 us"
+       << setw (12) << right << "peak KB" << endl;
+
+  cout << fixed << setprecision (2);
+
+  for (size_t i = 0; i < sizeof (churnBenchmarks) / sizeof (churnBenchmarks [0]); ++i)
+  {
+    AllocationCounter allocator;
+    lua_State* L = allocator.newState ();
+    luaL_openlibs (L);
+    addToState (L);
+    loadBenchmark (L, churnBenchmarks [i]);
+
+    lua_gc (L, LUA_GCCOLLECT, 0);
+    lua_gc (L, LUA_GCSTOP, 0);
+    allocator.resetPeak ();
+
+    vector <double> pauses;
+    int cycles = 0;
+
+    Stopwatch total;
+
+    for (int b = 0; b < batches; ++b)
+    {
+      unsigned long long const bytes = allocator.getBytes ();
+
+      lua_pushvalue (L, -1);
+      lua_pushinteger (L, batch);
+      lua_call (L, 1, 0);
+
+      int const debt = int ((allocator.getBytes () - bytes) / 1024) + 1;
+
+      Stopwatch step;
+      cycles += lua_gc (L, LUA_GCSTEP, debt);
+      pauses.push_back (step.getElapsedNanoseconds ());
+
+      // In Lua 5.1 a step resets the collector threshold, which lets the
+      // automatic collector run again during the next (untimed) batch.
+      lua_gc (L, LUA_GCSTOP, 0);
+    }
+
+    double const totalSeconds = total.getElapsedSeconds ();
+
+    lua_pop (L, 1);
+
+    double gcNanoseconds = 0;
+    for (size_t p = 0; p < pauses.size (); ++p)
+      gcNanoseconds += pauses [p];
+
+    sort (pauses.begin (), pauses.end ());
+
+    cout << setw (24) << left << churnBenchmarks [i].name
+         << setw (12) << right << totalSeconds * 1000
+         << setw (12) << right << gcNanoseconds / 1e6
+         << setw (10) << right << pauses.size ()
+         << setw (10) << right << cycles
+         << setw (12) << right << pauses.back () / 1000
+         << setw (12) << right << percentile (pauses, 99) / 1000
+         << setw (12) << right << allocator.getPeakBytes () / 1024.0 << endl;
+
+    lua_close (L);
+  }
+
+  return 0;
+}
+
+//------------------------------------------------------------------------------
+/**
+  A family of distinct classes for the registration benchmark.
+*/
+template <int N>
+struct Synth
+{
+  Synth () : value (N)
+  {
+  }
+
+  int f () const
+  {
+    return value;
+  }
+
+  int get () const
+  {
+    return value;
+  }
+
+  void set (int v)
+  {
+    value = v;
+  }
+
+  int value;
+};
+
+int synthFunction ()
+{
+  return 0;
+}
+
+//------------------------------------------------------------------------------
+/**
+  Registers the classes Synth <1> through Synth <N> in the namespace synth.
+
+  Each class gets the given number of member functions and properties, with
+  names made from the prefixes. If the class is already registered, the
+  registration is re-opened and the members are added to it.
+*/
+template <int N>
+struct SynthRegistrar
+{
+  static void add (lua_State* L, int functions, int properties,
+                   char const* functionPrefix, char const* propertyPrefix)
+  {
+    SynthRegistrar <N - 1>::add (L, functions, properties, functionPrefix, propertyPrefix);
+
+    char name [32];
+    sprintf (name, "Synth%d", N);
+
+    addMembers (getGlobalNamespace (L)
+      .beginNamespace ("synth")
+        .beginClass <Synth <N> > (name)
+          .template addConstructor <void (*) (void)> (),
+      functions, properties, functionPrefix, propertyPrefix);
+  }
+
+  template <class C>
+  static void addMembers (C& c, int functions, int properties,
+                          char const* functionPrefix, char const* propertyPrefix)
+  {
+    char name [32];
+
+    for (int i = 0; i < functions; ++i)
+    {
+      sprintf (name, "%s%d", functionPrefix, i);
+      c.addFunction (name, &Synth <N>::f);
+    }
+
+    for (int i = 0; i < properties; ++i)
+    {
+      sprintf (name, "%s%d", propertyPrefix, i);
+      c.addProperty (name, &Synth <N>::get, &Synth <N>::set);
+    }
+  }
+};
+
+template <>
+struct SynthRegistrar <0>
+{
+  static void add (lua_State*, int, int, char const*, char const*)
+  {
+  }
+};
+
+//------------------------------------------------------------------------------
+/**
+  Measure the cost of registering a large binding surface.
+
+  A fresh state registers free functions and classes with member functions
+  and properties. Then the same classes are re-opened with beginClass and
+  get as many members again. The memory per binding is what the state
+  retains, after a full collection.
+*/
+int runRegistrationBenchmark (Options const& options)
+{
+  int const classes = 100;
+  int const functions = 20;
+  int const properties = 5;
+  int const freeFunctions = 1000;
+
+  int const bindings [] =
+  {
+    freeFunctions + classes * (1 + functions + properties),
+    classes * (1 + functions + properties)
+  };
+
+  char const* const names [] =
+  {
+    "fresh state",
+    "re-opened classes"
+  };
+
+  vector <double> times [2];
+  double allocations [2] = { 0, 0 };
+  double bytes [2] = { 0, 0 };
+
+  for (int trial = 0; trial < options.trials; ++trial)
+  {
+    AllocationCounter allocator;
+    lua_State* L = allocator.newState ();
+    luaL_openlibs (L);
+
+    for (int phase = 0; phase < 2; ++phase)
+    {
+      lua_gc (L, LUA_GCCOLLECT, 0);
+      unsigned long long const count = allocator.getAllocations ();
+      size_t const used = allocator.getCurrentBytes ();
+
+      Stopwatch sw;
+
+      if (phase == 0)
+      {
+        Namespace ns = getGlobalNamespace (L).beginNamespace ("synth");
+
+        char name [32];
+        for (int i = 0; i < freeFunctions; ++i)
+        {
+          sprintf (name, "ff%d", i);
+          ns.addFunction (name, &synthFunction);
+        }
+      }
+
+      SynthRegistrar <classes>::add (L, functions, properties,
+        phase == 0 ? "f" : "g", phase == 0 ? "p" : "q");
+
+      times [phase].push_back (sw.getElapsedNanoseconds ());
+
+      lua_gc (L, LUA_GCCOLLECT, 0);
+      allocations [phase] = double (allocator.getAllocations () - count);
+      bytes [phase] = double (allocator.getCurrentBytes ()) - double (used);
+    }
+
+    lua_close (L);
+  }
+
+  cout << LUA_VERSION << ", " << classes << " classes with " << functions
+       << " functions and " << properties << " properties, " << freeFunctions
+       << " free functions, " << options.trials << " trials" << endl;
+
+  cout << setw (24) << left << "registration"
+       << setw (10) << right << "bindings"
+       << setw (12) << right << "median ms"
+       << setw (12) << right << "ns/binding"
+       << setw (12) << right << "allocs"
+       << setw (12) << right << "bytes" << endl;
+
+  cout << fixed << setprecision (2);
+
+  for (int phase = 0; phase < 2; ++phase)
+  {
+    sort (times [phase].begin (), times [phase].end ());
+    double const nanoseconds = percentile (times [phase], 50);
+
+    cout << setw (24) << left << names [phase]
+         << setw (10) << right << bindings [phase]
+         << setw (12) << right << nanoseconds / 1e6
+         << setw (12) << right << nanoseconds / bindings [phase]
+         << setw (12) << right << allocations [phase] / bindings [phase]
+         << setw (12) << right << bytes [phase] / bindings [phase] << endl;
+  }
+
+  return 0;
+}
+
+//------------------------------------------------------------------------------
+/**
+  Compare each operation through LuaBridge with a hand-written binding.
+
+  The ratio is of the times less the time of an empty loop, so that it is
+  the ratio of the binding costs alone.
+*/
+int runOverheadBenchmark (Options const& options)
+{
+  AllocationCounter allocator;
+  lua_State* L = allocator.newState ();
+  luaL_openlibs (L);
+  addToState (L);
+  HandWritten::addToState (L);
+
+  PerfCounters counters;
+
+  Benchmark const empty = { "empty loop", "", "", false };
+  double const loop = runBenchmark (L, empty, options, counters).median;
+
+  cout << LUA_VERSION << ", " << options.iterations << " iterations, "
+       << options.trials << " trials, empty loop " << fixed << setprecision (2)
+       << loop << " ns" << endl;
+
+  cout << setw (24) << left << "median ns"
+       << setw (12) << right << "LuaBridge"
+       << setw (12) << right << "by hand"
+       << setw (12) << right << "ratio" << endl;
+
+  for (size_t i = 0; i < sizeof (overheadBenchmarks) / sizeof (overheadBenchmarks [0]); ++i)
+  {
+    OverheadBenchmark const& o = overheadBenchmarks [i];
+
+    Benchmark const bound = { o.name, o.setup, o.operation, false };
+    Benchmark const handWritten = { o.name, o.handWrittenSetup, o.handWrittenOperation, false };
+
+    double const boundTime = runBenchmark (L, bound, options, counters).median;
+    double const handWrittenTime = runBenchmark (L, handWritten, options, counters).median;
+
+    cout << setw (24) << left << o.name
+         << setw (12) << right << boundTime
+         << setw (12) << right << handWrittenTime;
+
+    if (handWrittenTime > loop)
+      cout << setw (12) << right << (boundTime - loop) / (handWrittenTime - loop);
+    else
+      cout << setw (12) << right << "-";
+
+    cout << endl;
+  }
+
+  lua_close (L);
+
+  return 0;
+}
+
+//------------------------------------------------------------------------------
+/**
+  Print a row of the text output.
+*/
+void printResult (Result const& result, bool hasCycles, bool hasCounters)
+{
+  cout << setw (24) << left << result.name
+       << setw (12) << right << result.median
+       << setw (12) << right << result.p99
+       << setw (12) << right << result.stddev
+       << setw (12) << right << result.allocations
+       << setw (12) << right << result.bytes;
+  if (hasCycles)
+    cout << setw (12) << right << result.cycles;
+  if (hasCounters)
+  {
+    for (int c = 0; c < PerfCounters::numCounters; ++c)
+      cout << setw (12) << right << result.counters [c];
+  }
+  cout << endl;
+}
+
+//------------------------------------------------------------------------------
+/**
+  Run all the benchmarks and report the results.
+
+  @returns The number of regressions against the baseline, if there is one.
+*/
+int runTests (lua_State* L, Options const& options)
+{
+  PerfCounters counters;
+  bool const hasCycles = Stopwatch::hasCycleCounter ();
+  bool const hasCounters = counters.isAvailable ();
+  bool const isText = options.format == Options::text;
+
+  // Progress and comparisons go to stderr when stdout has machine output.
+  ostream& log = isText ? cout : cerr;
+
+  vector <Result> baseline;
+  string baselineLua;
+  if (!options.compare.empty () && !readJson (options.compare, baseline, baselineLua))
+  {
+    cerr << "Can't read baseline " << options.compare << endl;
+    return 1;
+  }
+
+  if (isText)
+  {
+    cout << LUA_VERSION << ", " << options.iterations << " iterations, "
+         << options.trials << " trials";
+    if (!hasCounters)
+      cout << ", hardware counters unavailable";
+    cout << endl;
+
+    cout << setw (24) << left << "benchmark"
+         << setw (12) << right << "median ns"
+         << setw (12) << right << "p99 ns"
+         << setw (12) << right << "stddev"
+         << setw (12) << right << "allocs"
+         << setw (12) << right << "bytes";
+    if (hasCycles)
+      cout << setw (12) << right << "tsc";
+    if (hasCounters)
+    {
+      for (int i = 0; i < PerfCounters::numCounters; ++i)
+        cout << setw (12) << right << PerfCounters::getName (i);
+    }
+    cout << endl;
+  }
+
+  log << fixed << setprecision (2);
+
+  vector <Result> results;
+
+  for (size_t i = 0; i < sizeof (benchmarks) / sizeof (benchmarks [0]); ++i)
+  {
+    results.push_back (runBenchmark (L, benchmarks [i], options, counters));
+
+    if (isText)
+      printResult (results.back (), hasCycles, hasCounters);
+  }
+
+  size_t const scriptBegin = results.size ();
+
+  if (!runScript (L, options, counters, results))
+    return 1;
+
+  if (isText)
+  {
+    for (size_t i = scriptBegin; i < results.size (); ++i)
+      printResult (results [i], hasCycles, hasCounters);
+  }
+
+  if (!isText)
+  {
+    ofstream file;
+    if (!options.output.empty ())
+    {
+      file.open (options.output.c_str ());
+      if (!file)
+      {
+        cerr << "Can't write " << options.output << endl;
+        return 1;
+      }
+    }
+
+    ostream& os = options.output.empty () ? cout : file;
+
+    if (options.format == Options::json)
+      writeJson (os, results, options, hasCycles, hasCounters);
+    else
+      writeCsv (os, results, hasCycles, hasCounters);
+  }
+
+  if (options.compare.empty ())
+    return 0;
+
+  log << endl << "Compared with " << options.compare << endl;
+  return compareResults (log, baseline, results, options.threshold);
+}
+
+//------------------------------------------------------------------------------
+/** Print the command line options. */
+void printUsage (ostream& os)
+{
+  os <<
+    "Options:\n"
+    "  --iterations N         operations timed in each trial\n"
+    "  --trials N             trials of each benchmark\n"
+    "  --format text|json|csv output format\n"
+    "  --output FILE          write the output to FILE instead of stdout\n"
+    "  --compare FILE         report regressions against a json baseline\n"
+    "  --threshold PERCENT    smallest change that is reported (default 5)\n"
+    "  --matrix FILE...       show json results of several builds side by side\n"
+    "  --scaling              run one Lua state per thread\n"
+    "  --threads N            most threads for --scaling\n"
+    "  --gc                   measure garbage collector pauses\n"
+    "  --registration         measure the cost of registration\n"
+    "  --overhead             compare with hand-written bindings\n"
+    "  --help                 show this message\n";
+}
+
+/** Read a positive integer, or return false. */
+bool parseCount (char const* arg, int& value)
+{
+  char* end;
+  long const n = strtol (arg, &end, 10);
+  if (end == arg || *end != 0 || n < 1 || n > 2147483647L)
+    return false;
+  value = int (n);
+  return true;
+}
+
+/** Read a number which is not negative, or return false. */
+bool parsePercent (char const* arg, double& value)
+{
+  char* end;
+  double const x = strtod (arg, &end);
+  if (end == arg || *end != 0 || !(x >= 0))
+    return false;
+  value = x;
+  return true;
+}
+
+/**
+  Parse the command line options.
+
+  An unknown argument, or an option with a missing or invalid value, is
+  reported on stderr and the function returns false.
+*/
+bool parseOptions (int argc, char** argv, Options& options)
+{
+  for (int i = 1; i < argc; ++i)
+  {
+    char const* const arg = argv [i];
+    bool const hasValue = i + 1 < argc;
+    bool valid = true;
+
+    if (!strcmp (arg, "--iterations") && hasValue)
+      valid = parseCount (argv [++i], options.iterations);
+    else if (!strcmp (arg, "--trials") && hasValue)
+      valid = parseCount (argv [++i], options.trials);
+    else if (!strcmp (arg, "--format") && hasValue)
+    {
+      ++i;
+      if (!strcmp (argv [i], "json"))
+        options.format = Options::json;
+      else if (!strcmp (argv [i], "csv"))
+        options.format = Options::csv;
+      else if (!strcmp (argv [i], "text"))
+        options.format = Options::text;
+      else
+        valid = false;
+    }
+    else if (!strcmp (arg, "--output") && hasValue)
+      options.output = argv [++i];
+    else if (!strcmp (arg, "--compare") && hasValue)
+      options.compare = argv [++i];
+    else if (!strcmp (arg, "--threshold") && hasValue)
+      valid = parsePercent (argv [++i], options.threshold);
+    else if (!strcmp (arg, "--scaling"))
+      options.scaling = true;
+    else if (!strcmp (arg, "--threads") && hasValue)
+      valid = parseCount (argv [++i], options.threads);
+    else if (!strcmp (arg, "--overhead"))
+      options.overhead = true;
+    else if (!strcmp (arg, "--registration"))
+      options.registration = true;
+    else if (!strcmp (arg, "--gc"))
+      options.gc = true;
+    else if (!strcmp (arg, "--matrix"))
+    {
+      while (i + 1 < argc && strncmp (argv [i + 1], "--", 2) != 0)
+        options.matrix.push_back (argv [++i]);
+      valid = !options.matrix.empty ();
+    }
+    else if (!strcmp (arg, "--help"))
+      options.help = true;
+    else
+      valid = false;
+
+    if (!valid)
+    {
+      cerr << "Invalid argument: " << arg;
+      if (i < argc && argv [i] != arg)
+        cerr << " " << argv [i];
+      cerr << endl;
+      return false;
+    }
+  }
+
+  return true;
+}
+
+}
+
+int runSpeedTests (int argc, char** argv)
+{
+  SpeedTests::Options options;
+  if (!SpeedTests::parseOptions (argc, argv, options))
+  {
+    SpeedTests::printUsage (std::cerr);
+    return 1;
+  }
+
+  if (options.help)
+  {
+    SpeedTests::printUsage (std::cout);
+    return 0;
+  }
+
+  if (!options.matrix.empty ())
+    return SpeedTests::showMatrix (options.matrix);
+
+  if (options.scaling)
+    return SpeedTests::runScaling (options);
+
+  if (options.gc)
+    return SpeedTests::runGcBenchmark (options);
+
+  if (options.registration)
+    return SpeedTests::runRegistrationBenchmark (options);
+
+  if (options.overhead)
+    return SpeedTests::runOverheadBenchmark (options);
+
+  SpeedTests::AllocationCounter allocator;
+  lua_State* L = allocator.newState ();
+  luaL_openlibs (L);
+
+  SpeedTests::addToState (L);
+  int const regressions = SpeedTests::runTests (L, options);
+
+  lua_close (L);
+
+  return regressions;
 }
@@ -30,6 +30,43 @@
 #ifndef LUABRIDGE_SPEEDTESTS_HEADER
 #define LUABRIDGE_SPEEDTESTS_HEADER
 
-extern void runSpeedTests ();
+/** Run the speed tests.
+
+    The options are --iterations N, the number of operations timed in each
+    trial, and --trials N.
+
+    --format text|json|csv selects the output, which goes to stdout or to
+    the file given with --output FILE. --compare FILE reads a baseline
+    written with --format json, and reports the benchmarks whose mean
+    changed by more than --threshold PERCENT (default 5) with statistical
+    significance.
+
+    --matrix FILE... shows the JSON results of several builds side by side,
+    for example of a build with LUAUNITYBUILD_VERSION=501 and one with 502,
+    without running the benchmarks. On Linux, the Lua 5.1 build is made with
+    CXXFLAGS=-DLUAUNITYBUILD_VERSION=501 make.
+
+    --scaling runs the benchmarks on one Lua state per thread instead, from
+    one thread up to --threads N (default: the number of hardware threads),
+    and reports the aggregate throughput.
+
+    --gc creates --iterations short-lived bound objects in several ways,
+    and reports the garbage collector's step times, the longest pause and
+    the peak memory.
+
+    --registration measures the time and memory per binding of registering
+    a large synthetic set of classes and functions, and of adding members
+    to classes which are already registered.
+
+    --overhead runs a set of operations through LuaBridge and through
+    equivalent hand-written lua_CFunctions, and reports the ratio.
+
+    --help lists the options. An unknown option or an invalid value prints
+    the list and fails.
+
+    @returns The number of regressions against the baseline, or 1 if the
+             arguments are not valid.
+*/
+extern int runSpeedTests (int argc, char** argv);
 
 #endif
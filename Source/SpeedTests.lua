@@ -0,0 +1,65 @@
+-- benchmark script to be run by the luabridge speed tests
+
+-- The loops run entirely inside Lua, so the numbers include the binding
+-- overhead of each operation but not the cost of entering Lua from C++.
+-- The report object is bound through LuaBridge and does the timing.
+
+local n, report = ...
+
+local function bench (name, loop)
+  loop (math.max (math.floor (n / 10), 1))
+  report:start ()
+  loop (n)
+  report:stop (name, n)
+end
+
+bench ("free function", function (n)
+  local f0 = f0
+  for i = 1, n do f0 () end
+end);
+
+bench ("method call", function (n)
+  local a = a
+  for i = 1, n do a:mf1 () end
+end);
+
+bench ("method with args", function (n)
+  local a = a
+  for i = 1, n do a:mf4 (i, i) end
+end);
+
+bench ("property update", function (n)
+  local a = a
+  for i = 1, n do a.prop = a.prop + 1 end
+end);
+
+bench ("data sum", function (n)
+  local a = a
+  local x = 0
+  for i = 1, n do x = x + a.data end
+end);
+
+bench ("object creation", function (n)
+  local A = A
+  for i = 1, n do local x = A () end
+end);
+
+bench ("object table walk", function (n)
+  local t = {}
+  for i = 1, 100 do t [i] = A () end
+  local j = 1
+  for i = 1, n do
+    t [j]:mf1 ()
+    j = j < 100 and j + 1 or 1
+  end
+end);
+
+bench ("inherited call", function (n)
+  local h = h5
+  for i = 1, n do h:hf () end
+end);
+
+bench ("string argument", function (n)
+  local f = strArg
+  for i = 1, n do f ("Hello, world") end
+end);
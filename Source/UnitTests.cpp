@@ -215,6 +215,104 @@ public:
 
 };
 
+class C : public A
+{
+public:
+  explicit C (string const& name_) : A (name_)
+  {
+  }
+};
+
+class D
+{
+public:
+  explicit D (int value_) : value (value_)
+  {
+  }
+
+  int getValue () const
+  {
+    return value;
+  }
+
+  void setValue (int value_)
+  {
+    value = value_;
+  }
+
+private:
+  int value;
+};
+
+// Keeps its own reference count for RefCountedPtr.
+class E : public RefCountedObjectType <int>
+{
+public:
+  explicit E (int value_) : value (value_)
+  {
+  }
+
+  int getValue () const
+  {
+    return value;
+  }
+
+private:
+  int value;
+};
+
+// Trivially destructible, so only a container push installs a finalizer.
+class H
+{
+public:
+  explicit H (int value_) : value (value_)
+  {
+  }
+
+  int getValue () const
+  {
+    return value;
+  }
+
+private:
+  int value;
+};
+
+class I : public H
+{
+public:
+  explicit I (int value_) : H (value_)
+  {
+  }
+};
+
+#if LUABRIDGE_HAS_STD_SHARED_PTR
+// Held in a std::shared_ptr.
+class F
+{
+public:
+  explicit F (int value_) : value (value_)
+  {
+  }
+
+  int getValue () const
+  {
+    return value;
+  }
+
+private:
+  int value;
+};
+
+class G : public F
+{
+public:
+  explicit G (int value_) : F (value_)
+  {
+  }
+};
+#endif
+
 /*
  * Test functions
  */
@@ -240,11 +338,46 @@ string testRetStdString ()
   return ret;
 }
 
+string testRetStdStringNul ()
+{
+  return string ("Hello\0world", 11);
+}
+
+unsigned long long testRetULongLong ()
+{
+  return 1ULL << 60;
+}
+
 void testParamInt (int a)
 {
   g_success = (a == 47);
 }
 
+void testParamUnsignedChar (unsigned char c)
+{
+  g_success = (c == 200);
+}
+
+void testParamULongLong (unsigned long long n)
+{
+  g_success = (n == 1ULL << 60);
+}
+
+int testEchoInt (int n)
+{
+  return n;
+}
+
+unsigned char testEchoUnsignedChar (unsigned char c)
+{
+  return c;
+}
+
+long long testEchoLongLong (long long n)
+{
+  return n;
+}
+
 void testParamBool (bool b)
 {
   g_success = b;
@@ -270,6 +403,16 @@ void testParamStdStringRef (const string &str)
   g_success = !strcmp (str.c_str(), "Hello, world");
 }
 
+void testParamStdStringNul (string str)
+{
+  g_success = (str == string ("Hello\0world", 11));
+}
+
+void testParamStringView (StringView str)
+{
+  g_success = (str.size () == 11 && !memcmp (str.data (), "Hello\0world", 11));
+}
+
 void testParamAPtr (A * a)
 {
   a->setSuccess();
@@ -302,6 +445,107 @@ RefCountedPtr <A const> testRetSharedPtrConstA ()
   return sp_A;
 }
 
+RefCountedPtr <D> testRetSharedPtrD ()
+{
+  static RefCountedPtr <D> sp_D (new D (47));
+  return sp_D;
+}
+
+long testSharedPtrDUseCount ()
+{
+  // Not counting the copy returned by testRetSharedPtrD.
+  return testRetSharedPtrD ().use_count () - 1;
+}
+
+RefCountedPtr <E> testRetSharedPtrE ()
+{
+  static RefCountedPtr <E> sp_E (new E (48));
+  return sp_E;
+}
+
+long testSharedPtrEUseCount ()
+{
+  // Not counting the copy returned by testRetSharedPtrE.
+  return testRetSharedPtrE ().use_count () - 1;
+}
+
+RefCountedPtr <E>& getKeptE ()
+{
+  static RefCountedPtr <E> kept;
+  return kept;
+}
+
+void testParamSharedPtrE (RefCountedPtr <E> e)
+{
+  getKeptE () = e;
+}
+
+long testKeptEUseCount ()
+{
+  return getKeptE ().use_count ();
+}
+
+int testRefCountTableSize ()
+{
+  return int (RefCountedPtrBase::getRefCountTableSize ());
+}
+
+#if LUABRIDGE_HAS_STD_SHARED_PTR
+std::shared_ptr <G> testRetStdSharedPtrG ()
+{
+  static std::shared_ptr <G> sp_G (new G (50));
+  return sp_G;
+}
+
+long testStdSharedPtrGUseCount ()
+{
+  // Not counting the copy returned by testRetStdSharedPtrG.
+  return testRetStdSharedPtrG ().use_count () - 1;
+}
+
+std::shared_ptr <F>& getKeptF ()
+{
+  static std::shared_ptr <F> kept;
+  return kept;
+}
+
+void testParamStdSharedPtrF (std::shared_ptr <F> f)
+{
+  getKeptF () = f;
+}
+
+long testKeptFUseCount ()
+{
+  return getKeptF ().use_count ();
+}
+#endif
+
+A testRetA ()
+{
+  return A ("by value");
+}
+
+A* testRetAPtr ()
+{
+  static A a ("from C");
+  return &a;
+}
+
+void testSetIdentityCache (bool enable, lua_State* L)
+{
+  setIdentityCache (L, enable);
+}
+
+// Flattens I after H has installed its finalizer.
+void testDeriveFlattenedI (lua_State* L)
+{
+  getGlobalNamespace (L)
+    .deriveClass <I, H> ("I", true)
+      .addConstructor <void (*) (int)> ()
+    .endClass ()
+  ;
+}
+
 // add our own functions and classes to a Lua environment
 void addToState (lua_State *L)
 {
@@ -313,17 +557,28 @@ void addToState (lua_State *L)
     .addFunction ("testRetFloat", &testRetFloat)
     .addFunction ("testRetConstCharPtr", &testRetConstCharPtr)
     .addFunction ("testRetStdString", &testRetStdString)
+    .addFunction ("testRetStdStringNul", &testRetStdStringNul)
+    .addFunction ("testRetULongLong", &testRetULongLong)
     .addFunction ("testParamInt", &testParamInt)
+    .addFunction ("testParamIntUnchecked", &testParamInt, Unchecked ())
+    .addFunction ("testParamUnsignedChar", &testParamUnsignedChar)
+    .addFunction ("testParamULongLong", &testParamULongLong)
+    .addFunction ("testEchoInt", &testEchoInt)
+    .addFunction ("testEchoUnsignedChar", &testEchoUnsignedChar)
+    .addFunction ("testEchoLongLong", &testEchoLongLong)
     .addFunction ("testParamBool", &testParamBool)
     .addFunction ("testParamFloat", &testParamFloat)
     .addFunction ("testParamConstCharPtr", &testParamConstCharPtr)
     .addFunction ("testParamStdString", &testParamStdString)
     .addFunction ("testParamStdStringRef", &testParamStdStringRef)
+    .addFunction ("testParamStdStringNul", &testParamStdStringNul)
+    .addFunction ("testParamStringView", &testParamStringView)
     .beginClass <A> ("A")
       .addConstructor <void (*) (const string &), RefCountedPtr <A> > ()
       .addFunction ("testVirtual", &A::testVirtual)
       .addFunction ("getName", &A::getName)
       .addFunction ("testSucceeded", &A::testSucceeded)
+      .addFunction ("getNameUnchecked", &A::getName, Unchecked ())
       .addFunction ("__add", &A::operator+)
       .addData ("testProp", &A::testProp)
       .addProperty ("testProp2", &A::testPropGet, &A::testPropSet)
@@ -335,13 +590,61 @@ void addToState (lua_State *L)
       .addConstructor <void (*) (const string &), RefCountedPtr <B> > ()
       .addStaticFunction ("testStatic2", &B::testStatic2)
     .endClass ()
+    .deriveClass <C, A> ("C", true)
+      .addConstructor <void (*) (const string &), RefCountedPtr <C> > ()
+    .endClass ()
+    // Added after deriving, to test propagation to flattened classes.
+    .beginClass <A> ("A")
+      .addFunction ("getNameAfterDerive", &A::getName)
+    .endClass ()
+    .beginClass <D> ("D")
+      .addConstructor <void (*) (int)> ()
+      .addFunction ("getValue", &D::getValue)
+      .addFunction ("setValue", &D::setValue)
+    .endClass ()
+    .beginClass <E> ("E")
+      .addConstructor <void (*) (int), RefCountedPtr <E> > ()
+      .addFunction ("getValue", &E::getValue)
+    .endClass ()
+    .beginClass <H> ("H")
+      .addConstructor <void (*) (int), RefCountedPtr <H> > ()
+      .addFunction ("getValue", &H::getValue)
+    .endClass ()
     .addFunction ("testParamAPtr", &testParamAPtr)
+    .addFunction ("testParamAPtrUnchecked", &testParamAPtr, Unchecked ())
     .addFunction ("testParamAPtrConst", &testParamAPtrConst)
     .addFunction ("testParamConstAPtr", &testParamConstAPtr)
     .addFunction ("testParamSharedPtrA", &testParamSharedPtrA)
     .addFunction ("testRetSharedPtrA", &testRetSharedPtrA)
     .addFunction ("testRetSharedPtrConstA", &testRetSharedPtrConstA)
+    .addFunction ("testRetA", &testRetA)
+    .addFunction ("testRetSharedPtrD", &testRetSharedPtrD)
+    .addFunction ("testSharedPtrDUseCount", &testSharedPtrDUseCount)
+    .addFunction ("testRetSharedPtrE", &testRetSharedPtrE)
+    .addFunction ("testSharedPtrEUseCount", &testSharedPtrEUseCount)
+    .addFunction ("testParamSharedPtrE", &testParamSharedPtrE)
+    .addFunction ("testKeptEUseCount", &testKeptEUseCount)
+    .addFunction ("testRefCountTableSize", &testRefCountTableSize)
+    .addFunction ("testRetAPtr", &testRetAPtr)
+    .addFunction ("testSetIdentityCache", &testSetIdentityCache)
+    .addFunction ("testDeriveFlattenedI", &testDeriveFlattenedI)
+  ;
+
+#if LUABRIDGE_HAS_STD_SHARED_PTR
+  getGlobalNamespace (L)
+    .beginClass <F> ("F")
+      .addConstructor <void (*) (int), std::shared_ptr <F> > ()
+      .addFunction ("getValue", &F::getValue)
+    .endClass ()
+    .deriveClass <G, F> ("G")
+      .addConstructor <void (*) (int), std::shared_ptr <G> > ()
+    .endClass ()
+    .addFunction ("testRetStdSharedPtrG", &testRetStdSharedPtrG)
+    .addFunction ("testStdSharedPtrGUseCount", &testStdSharedPtrGUseCount)
+    .addFunction ("testParamStdSharedPtrF", &testParamStdSharedPtrF)
+    .addFunction ("testKeptFUseCount", &testKeptFUseCount)
   ;
+#endif
 }
 
 void resetTests ()
@@ -40,6 +40,7 @@ assert(testRetInt() == 47);
 assert(testRetFloat() == 47.0);
 assert(testRetConstCharPtr() == "Hello, world");
 assert(testRetStdString() == "Hello, world");
+assert(testRetStdStringNul() == "Hello\0world");
 
 testParamInt(47);                       assert(testSucceeded());
 testParamBool(true);                    assert(testSucceeded());
@@ -47,6 +48,31 @@ testParamFloat(47.0);                   assert(testSucceeded());
 testParamConstCharPtr("Hello, world");  assert(testSucceeded());
 testParamStdString("Hello, world");     assert(testSucceeded());
 testParamStdStringRef("Hello, world");  assert(testSucceeded());
+testParamStdStringNul("Hello\0world");  assert(testSucceeded());
+testParamStringView("Hello\0world");    assert(testSucceeded());
+
+-- test integer conversions
+
+assert(testRetULongLong() == 2^60);
+testParamUnsignedChar(200);             assert(testSucceeded());
+testParamULongLong(2^60);               assert(testSucceeded());
+ok, err = pcall(testParamUnsignedChar, 256);   assert(not ok and string.find(err, "out of range"));
+ok, err = pcall(testParamULongLong, -1);       assert(not ok and string.find(err, "out of range"));
+ok, err = pcall(testParamInt, 2^40);           assert(not ok and string.find(err, "out of range"));
+assert(testEchoInt(2^31 - 1) == 2^31 - 1 and testEchoInt(-2^31) == -2^31);
+assert(testEchoInt(2.75) == 2 and testEchoInt(-2.75) == -2);
+ok, err = pcall(testEchoInt, 2^31);            assert(not ok and string.find(err, "out of range"));
+ok, err = pcall(testEchoInt, -2^31 - 1);       assert(not ok and string.find(err, "out of range"));
+ok, err = pcall(testEchoInt, 0/0);             assert(not ok and string.find(err, "out of range"));
+assert(testEchoInt(2^31 - 0.5) == 2^31 - 1 and testEchoInt(-2^31 - 0.5) == -2^31);
+assert(testEchoUnsignedChar(-0.5) == 0 and testEchoUnsignedChar(255.5) == 255);
+ok, err = pcall(testEchoUnsignedChar, -1);     assert(not ok and string.find(err, "out of range"));
+assert(testEchoLongLong(-2^63) == -2^63);
+ok, err = pcall(testEchoLongLong, 2^63);       assert(not ok and string.find(err, "out of range"));
+
+-- test unchecked functions
+
+testParamIntUnchecked(47);              assert(testSucceeded());
 
 -- test static methods of classes registered from C++
 
@@ -90,6 +116,17 @@ assert(constA.testVirtual == nil);
 testParamConstAPtr(constA);        assert(constA:testSucceeded());
 assert(pcall(testParamAPtr, constA) == false, "attempt to call nil value");
 
+-- test unchecked member functions
+
+assert(object1:getNameUnchecked() == "object1");
+assert(object2:getNameUnchecked() == "object2");
+testParamAPtrUnchecked(object1);  assert(object1:testSucceeded());
+
+-- test type checking
+
+ok, err = pcall(testParamAPtr, 47);   assert(not ok and string.find(err, "A expected, got number"));
+ok, err = pcall(testParamAPtr, {});   assert(not ok and string.find(err, "A expected, got table"));
+
 -- test properties
 
 assert(object1.testProp == 47);
@@ -104,4 +141,82 @@ object1.testProp2 = 49;          assert(testAFnCalled(FN_PROPSET) and object1.te
 object1a = object1 + object1;      assert(testAFnCalled(FN_OPERATOR));
 assert(object1a:getName() == "object1 + object1");
 
+-- test flattened derived classes
+
+object3 = C("object3");         assert(testAFnCalled(FN_CTOR));
+object3:testVirtual();          assert(testAFnCalled(FN_VIRTUAL));
+assert(object3:getName() == "object3");
+assert(object3.testProp == 47);
+assert(object3.testProp2 == 47);    assert(testAFnCalled(FN_PROPGET));
+object3.testProp2 = 48;         assert(testAFnCalled(FN_PROPSET) and object3.testProp == 48);
+testParamAPtr(object3);         assert(object3:testSucceeded());
+assert(object3:getNameAfterDerive() == "object3");
+
+-- test that a flattened class does not inherit its base's finalizer
+
+object10 = H(53);
+testDeriveFlattenedI();
+object10 = I(54);               assert(object10:getValue() == 54);
+object10 = nil; collectgarbage();
+
+-- test classes with member functions only
+
+object4 = D(47);
+assert(object4:getValue() == 47);
+object4:setValue(48);           assert(object4:getValue() == 48);
+assert(object4.noSuchMember == nil);
+assert(object4.__index == nil and object4.__newindex == nil);
+
+-- test the identity cache
+
+assert(testRetAPtr() ~= testRetAPtr());
+testSetIdentityCache(true);
+assert(testRetAPtr() == testRetAPtr());
+assert(testRetSharedPtrA() == testRetSharedPtrA());
+assert(testRetAPtr():getName() == "from C");
+collectgarbage();
+assert(testRetAPtr() == testRetAPtr());
+testSetIdentityCache(false);
+
+-- test finalizers
+
+object5 = testRetA();           testAFnCalled(FN_DTOR);
+assert(object5:getName() == "by value");
+object5 = nil; collectgarbage(); assert(testAFnCalled(FN_DTOR));
+object5 = B("object5");
+object5 = nil; collectgarbage(); assert(testBFnCalled(FN_DTOR));
+object6 = testRetSharedPtrD();  assert(testSharedPtrDUseCount() == 2);
+object6 = nil; collectgarbage(); assert(testSharedPtrDUseCount() == 1);
+
+-- test intrusive reference counts
+
+object7 = testRetSharedPtrE();  assert(testSharedPtrEUseCount() == 2);
+assert(object7:getValue() == 48);
+object7 = nil; collectgarbage(); assert(testSharedPtrEUseCount() == 1);
+object7 = E(49);
+assert(object7:getValue() == 49);
+testParamSharedPtrE(object7);   assert(testKeptEUseCount() == 2);
+object7 = nil; collectgarbage(); assert(testKeptEUseCount() == 1);
+
+-- test that released objects leave the reference count table
+
+collectgarbage();
+local tableSize = testRefCountTableSize();
+object8 = A("counted");           assert(testRefCountTableSize() == tableSize + 1);
+object8 = nil; collectgarbage();  assert(testRefCountTableSize() == tableSize);
+
+-- test std::shared_ptr, when the compiler has it
+
+if testRetStdSharedPtrG then
+  object9 = testRetStdSharedPtrG();   assert(testStdSharedPtrGUseCount() == 2);
+  assert(object9:getValue() == 50);
+  testParamStdSharedPtrF(object9);    assert(testStdSharedPtrGUseCount() == 3);
+  object9 = nil; collectgarbage();    assert(testStdSharedPtrGUseCount() == 2);
+  testParamStdSharedPtrF(nil);        assert(testStdSharedPtrGUseCount() == 1);
+  object9 = G(51);
+  testParamStdSharedPtrF(object9);    assert(testKeptFUseCount() == 2);
+  object9 = nil; collectgarbage();    assert(testKeptFUseCount() == 1);
+  assert(not pcall(testParamStdSharedPtrF, D(52)));
+end
+
 print("All tests succeeded.");